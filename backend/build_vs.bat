@@ -22,7 +22,7 @@ echo Compiler found! Building...
 echo.
 
 REM Compile the server
-cl /EHsc /std:c++17 /Fe:server.exe main.cpp /I.. ws2_32.lib
+cl /EHsc /O2 /std:c++17 /Fe:server.exe main.cpp /I.. ws2_32.lib
 
 if %errorlevel% equ 0 (
     echo.
@@ -28,7 +28,7 @@ echo Found libcurl at: %VCPKG_ROOT%\installed\x64-windows\lib\libcurl.lib
 echo.
 echo Compiling...
 
-cl.exe /EHsc /std:c++17 /I.. /I%VCPKG_ROOT%\installed\x64-windows\include main.cpp /Fe:server.exe /link /LIBPATH:%VCPKG_ROOT%\installed\x64-windows\lib libcurl.lib ws2_32.lib wldap32.lib advapi32.lib crypt32.lib normaliz.lib
+cl.exe /EHsc /O2 /std:c++17 /I.. /I%VCPKG_ROOT%\installed\x64-windows\include main.cpp /Fe:server.exe /link /LIBPATH:%VCPKG_ROOT%\installed\x64-windows\lib libcurl.lib zlib.lib ws2_32.lib wldap32.lib advapi32.lib crypt32.lib normaliz.lib
 
 if %ERRORLEVEL% NEQ 0 (
     echo.
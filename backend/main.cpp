@@ -15,11 +15,35 @@
 #include <sstream>
 #include <iomanip>
 #include <curl/curl.h>
+#include <zlib.h>
 #include <chrono>
 #include <thread>
 #include <mutex>
 #include <future>
 #include <fstream>
+#include <array>
+#include <atomic>
+#include <deque>
+#include <new>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <functional>
+#include <condition_variable>
+#include <unordered_set>
+#include <memory>
+#include <filesystem>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
@@ -27,6 +51,31 @@
 
 using json = nlohmann::json;
 
+// A point projected onto the nearest road segment (see snap_to_segment()).
+// The road runs along the geometry of `edge` from start_node to end_node;
+// reverse_edge is the end -> start edge of a two-way road, -1 on a one-way
+// street. Travel times between the projection and each end are infinite
+// where the road cannot be driven that way.
+struct EdgeSnap
+{
+    long start_node = -1;
+    long end_node = -1;
+    int edge = -1;
+    int reverse_edge = -1;
+    int piece = 0;             // polyline piece holding the projection, 0 = from start_node
+    double offset_start_m = 0; // along the road from start_node to the projection
+    double offset_end_m = 0;   // along the road from the projection to end_node
+    double distance_m = -1;    // from the point to the projection
+    double lat = 0;
+    double lon = 0;
+    double seconds_from_start = 0; // start_node -> projection
+    double seconds_from_end = 0;   // end_node -> projection
+    double seconds_to_start = 0;   // projection -> start_node
+    double seconds_to_end = 0;     // projection -> end_node
+
+    bool valid() const { return edge != -1; }
+};
+
 struct Student
 {
     std::string student_id;
@@ -34,6 +83,10 @@ struct Student
     double lon;
     long snapped_node_id;
     std::string category;
+    double snap_distance_m = -1; // to the snapped road vertex (or road, with edge_snap), -1 when unsnapped
+    int component_id = -1;       // component of the snapped vertex
+    EdgeSnap edge_snap;          // set by segment snapping; snapped_node_id is then its nearer end
+    long row_key = -1;           // allotment_matrix row, see student_matrix_rows()
 };
 
 struct Centre
@@ -48,15 +101,22 @@ struct Centre
     bool is_female_only;
 };
 
+// Candidate assignment; student and centre are indices into `students` and `centres`
 struct AssignmentPair
 {
     double distance;
-    std::string student_id;
-    std::string centre_id;
+    int student;
+    int centre;
 
+    // Total order (distance, then student, then centre) so that equal
+    // distances are always resolved the same way
     bool operator>(const AssignmentPair &other) const
     {
-        return distance > other.distance;
+        if (distance != other.distance)
+            return distance > other.distance;
+        if (student != other.student)
+            return student > other.student;
+        return centre > other.centre;
     }
 };
 
@@ -67,31 +127,175 @@ struct Node
     double lon;
 };
 
-struct KDTreeNode
+// A point indexed by the KD-tree; node_id is the road vertex it snaps to
+struct KDPoint
 {
-    long node_id;
     double lat;
     double lon;
-    int axis;
-    KDTreeNode *left;
-    KDTreeNode *right;
+    long node_id;
+};
+
+// Immutable compressed-sparse-row road graph. Vertices are dense indices
+// 0..num_nodes()-1; the out-edges of u are [offsets[u], offsets[u + 1]).
+struct RoadGraph
+{
+    std::vector<int> offsets;
+    std::vector<int> targets;
+    std::vector<double> weights;
+
+    // Dense index -> OSM id and coordinates, plus the reverse id mapping
+    std::vector<long> osm_ids;
+    std::vector<double> lat;
+    std::vector<double> lon;
+    std::unordered_map<long, int> index_of;
+
+    // Road geometry of each edge: coordinates of the shape vertices collapsed
+    // into it by contract_degree2_chains(), in travel order, at
+    // [shape_offsets[e], shape_offsets[e + 1]). Empty until then.
+    std::vector<int> shape_offsets;
+    std::vector<double> shape_lat;
+    std::vector<double> shape_lon;
+
+    // Derived by index_in_edges(g), for searches that run against edge
+    // direction: in-edges of v are in_sources/in_weights[in_offsets[v]..in_offsets[v+1]).
+    // max_speed_mps bounds haversine distance / weight over all edges (0 when
+    // some edge has zero weight but nonzero length), so haversine / max_speed_mps
+    // never overestimates the remaining travel time.
+    std::vector<int> in_offsets;
+    std::vector<int> in_sources;
+    std::vector<double> in_weights;
+    double max_speed_mps = 0.0;
+
+    int num_nodes() const { return (int)osm_ids.size(); }
+    int num_edges() const { return (int)targets.size(); }
+    int degree(int u) const { return offsets[u + 1] - offsets[u]; }
+
+    int index(long osm_id) const
+    {
+        auto it = index_of.find(osm_id);
+        return it == index_of.end() ? -1 : it->second;
+    }
+
+    void clear()
+    {
+        offsets.clear();
+        targets.clear();
+        weights.clear();
+        osm_ids.clear();
+        lat.clear();
+        lon.clear();
+        index_of.clear();
+        shape_offsets.clear();
+        shape_lat.clear();
+        shape_lon.clear();
+        in_offsets.clear();
+        in_sources.clear();
+        in_weights.clear();
+        max_speed_mps = 0.0;
+    }
+
+    bool has_geometry() const { return !shape_offsets.empty(); }
+};
+
+// Allocator returning cache-line aligned storage
+template <typename T>
+struct CacheAlignedAllocator
+{
+    using value_type = T;
+    static constexpr std::size_t alignment = 64;
+
+    CacheAlignedAllocator() = default;
+    template <typename U>
+    CacheAlignedAllocator(const CacheAlignedAllocator<U> &) {}
+
+    T *allocate(std::size_t n)
+    {
+        return static_cast<T *>(::operator new(n * sizeof(T), std::align_val_t(alignment)));
+    }
+
+    void deallocate(T *p, std::size_t)
+    {
+        ::operator delete(p, std::align_val_t(alignment));
+    }
+
+    template <typename U>
+    bool operator==(const CacheAlignedAllocator<U> &) const { return true; }
+    template <typename U>
+    bool operator!=(const CacheAlignedAllocator<U> &) const { return false; }
+};
+
+// Travel times from snapped student nodes (rows, sorted by key: OSM ids, and
+// negative keys for students snapped onto a road segment) to centres
+// (columns, in the order of `centres`). One contiguous float block; every row
+// starts on a cache line. Unreachable entries are +infinity.
+struct DistanceMatrix
+{
+    static constexpr size_t FLOATS_PER_LINE = 64 / sizeof(float);
+
+    std::vector<long> row_nodes;
+    size_t num_centres = 0;
+    size_t stride = 0; // floats per row, padded to whole cache lines
+    std::vector<float, CacheAlignedAllocator<float>> values;
 
-    KDTreeNode(long id, double lat_, double lon_, int axis_)
-        : node_id(id), lat(lat_), lon(lon_), axis(axis_), left(nullptr), right(nullptr) {}
+    void reset(std::vector<long> nodes, size_t centre_count)
+    {
+        row_nodes = std::move(nodes);
+        num_centres = centre_count;
+        stride = (centre_count + FLOATS_PER_LINE - 1) / FLOATS_PER_LINE * FLOATS_PER_LINE;
+        values.assign(row_nodes.size() * stride, std::numeric_limits<float>::infinity());
+    }
+
+    void clear()
+    {
+        row_nodes.clear();
+        num_centres = 0;
+        stride = 0;
+        values.clear();
+        values.shrink_to_fit();
+    }
+
+    int num_rows() const { return (int)row_nodes.size(); }
+
+    // Row of a snapped node, -1 if it has none
+    int row_of(long node_id) const
+    {
+        auto it = std::lower_bound(row_nodes.begin(), row_nodes.end(), node_id);
+        return it != row_nodes.end() && *it == node_id ? (int)(it - row_nodes.begin()) : -1;
+    }
+
+    float *row(int r) { return values.data() + r * stride; }
+    const float *row(int r) const { return values.data() + r * stride; }
+
+    // Distance in seconds, numeric_limits<double>::max() if unreachable or unknown
+    double distance(long node_id, int centre) const
+    {
+        int r = row_of(node_id);
+        if (r == -1 || !std::isfinite(row(r)[centre]))
+            return std::numeric_limits<double>::max();
+        return row(r)[centre];
+    }
+
+    size_t bytes() const { return values.size() * sizeof(float); }
 };
 
 // ==================== GLOBAL STATE ====================
 
+// Staging adjacency filled by the graph builders; moved into road_graph by
+// finalize_road_graph() and empty afterwards.
 std::unordered_map<long, std::vector<std::pair<long, double>>> graph;
 std::unordered_map<long, Node> nodes;
-KDTreeNode *kdtree_root = nullptr;
-std::unordered_map<long, std::unordered_map<std::string, double>> allotment_lookup_map; // node_id -> (centre_id -> dist)
+RoadGraph road_graph;
+DistanceMatrix allotment_matrix; // snapped student node x centre -> travel time
+// The allotment refers to centres and students by their index in these
+// vectors; string IDs are only used at the API boundary
 std::vector<Centre> centres;
 std::vector<Student> students;
 std::unordered_map<std::string, std::string> final_assignments;
 
-// New: component map
-std::unordered_map<long, int> node_component;
+// New: component map (dense node index -> component id, -1 for isolated)
+std::vector<int> node_component;
+std::vector<int> component_size; // component id -> vertex count (index 0 unused)
+int main_component = -1;         // largest component, -1 when the graph has none
 
 // ==================== UTILITY FUNCTIONS ====================
 
@@ -110,1228 +314,5678 @@ double haversine(double lat1, double lon1, double lat2, double lon2)
     return R * c;
 }
 
-// ==================== FORWARD DECLARATIONS ====================
-
-std::vector<long> find_k_nearest_nodes(double lat, double lon, int k);
-long find_best_snap_node_fast(double lat, double lon);
-void snap_all_students_fast();
-std::vector<long> clean_and_validate_path(const std::vector<long> &path);
-std::vector<long> a_star_bidirectional(long start_node, long goal_node);
-
-// ==================== KD-TREE IMPLEMENTATION ====================
+// ==================== WORKER POOL ====================
 
-KDTreeNode *build_kdtree(std::vector<std::pair<long, std::pair<double, double>>> &points, int depth)
+// Number of worker threads for a job of `tasks` independent tasks: one per
+// hardware thread, never more than there are tasks
+int worker_count(size_t tasks)
 {
-    if (points.empty())
-        return nullptr;
-
-    int axis = depth % 2;
-
-    std::sort(points.begin(), points.end(),
-              [axis](const auto &a, const auto &b)
-              {
-                  return (axis == 0) ? a.second.first < b.second.first : a.second.second < b.second.second;
-              });
-
-    size_t median_idx = points.size() / 2;
-    long median_id = points[median_idx].first;
-    double median_lat = points[median_idx].second.first;
-    double median_lon = points[median_idx].second.second;
-
-    KDTreeNode *node = new KDTreeNode(median_id, median_lat, median_lon, axis);
-
-    std::vector<std::pair<long, std::pair<double, double>>> left_points(points.begin(), points.begin() + median_idx);
-    std::vector<std::pair<long, std::pair<double, double>>> right_points(points.begin() + median_idx + 1, points.end());
-
-    node->left = build_kdtree(left_points, depth + 1);
-    node->right = build_kdtree(right_points, depth + 1);
-
-    return node;
+    size_t hardware = std::max(1u, std::thread::hardware_concurrency());
+    return (int)std::max<size_t>(1, std::min(hardware, tasks));
 }
 
-void kdtree_nearest_helper(KDTreeNode *node, double target_lat, double target_lon,
-                           long &best_id, double &best_dist)
+struct WorkerStats
 {
-    if (!node)
-        return;
+    size_t tasks = 0;  // tasks run by this worker
+    size_t steals = 0; // of which taken from another worker's queue
+    double busy_ms = 0;
+};
+
+// Fixed-size work-stealing pool. Each run() splits the task range into one
+// contiguous block per worker; a worker takes tasks from the front of its own
+// queue and, once that is empty, steals from the back of the others. The
+// task set is fixed for the run, so a worker that finds every queue empty
+// is done. fn(task, worker) gets a stable worker index for per-worker state.
+class WorkStealingPool
+{
+public:
+    explicit WorkStealingPool(int workers) : num_workers(std::max(1, workers)) {}
 
-    double dist = haversine(target_lat, target_lon, node->lat, node->lon);
+    int size() const { return num_workers; }
 
-    if (dist < best_dist)
+    template <typename Fn>
+    std::vector<WorkerStats> run(size_t tasks, Fn fn)
     {
-        best_dist = dist;
-        best_id = node->node_id;
-    }
+        std::vector<TaskQueue> queues(num_workers);
+        for (size_t t = 0; t < tasks; t++)
+            queues[t * num_workers / tasks].tasks.push_back(t);
 
-    double diff = (node->axis == 0) ? (target_lat - node->lat) : (target_lon - node->lon);
-    KDTreeNode *near_side = (diff < 0) ? node->left : node->right;
-    KDTreeNode *far_side = (diff < 0) ? node->right : node->left;
+        std::vector<WorkerStats> stats(num_workers);
+        auto work = [&](int worker)
+        {
+            size_t task;
+            while (true)
+            {
+                if (!queues[worker].pop_front(task))
+                {
+                    bool found = false;
+                    for (int i = 1; i < num_workers && !found; i++)
+                        found = queues[(worker + i) % num_workers].steal_back(task);
+                    if (!found)
+                        break;
+                    stats[worker].steals++;
+                }
 
-    kdtree_nearest_helper(near_side, target_lat, target_lon, best_id, best_dist);
+                auto task_start = std::chrono::high_resolution_clock::now();
+                fn(task, worker);
+                auto task_end = std::chrono::high_resolution_clock::now();
+                stats[worker].busy_ms += std::chrono::duration<double, std::milli>(task_end - task_start).count();
+                stats[worker].tasks++;
+            }
+        };
 
-    double axis_dist = std::abs(diff) * 111000.0;
-    if (axis_dist < best_dist)
-    {
-        kdtree_nearest_helper(far_side, target_lat, target_lon, best_id, best_dist);
+        std::vector<std::thread> threads;
+        for (int w = 1; w < num_workers; w++)
+            threads.emplace_back(work, w);
+        work(0);
+        for (auto &t : threads)
+            t.join();
+
+        return stats;
     }
-}
 
-long find_nearest_node(double lat, double lon)
-{
-    if (kdtree_root)
+private:
+    struct TaskQueue
     {
-        long best_id = -1;
-        double best_dist = std::numeric_limits<double>::max();
-        kdtree_nearest_helper(kdtree_root, lat, lon, best_id, best_dist);
+        std::mutex lock;
+        std::deque<size_t> tasks;
 
-        if (best_id != -1)
-            return best_id;
-    }
+        bool pop_front(size_t &task)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (tasks.empty())
+                return false;
+            task = tasks.front();
+            tasks.pop_front();
+            return true;
+        }
 
-    std::vector<long> nearest = find_k_nearest_nodes(lat, lon, 1);
+        bool steal_back(size_t &task)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (tasks.empty())
+                return false;
+            task = tasks.back();
+            tasks.pop_back();
+            return true;
+        }
+    };
 
-    if (nearest.empty())
-        return -1;
+    int num_workers;
+};
 
-    return nearest[0];
+// Run fn(task, worker) for every task in [0, tasks) on `workers` threads
+template <typename Fn>
+void parallel_for(size_t tasks, int workers, Fn fn)
+{
+    WorkStealingPool(workers).run(tasks, fn);
 }
 
-std::vector<long> find_k_nearest_nodes(double lat, double lon, int k = 5)
-{
-    std::vector<std::pair<double, long>> distances;
-    distances.reserve(nodes.size());
+// ==================== SEARCH WORKSPACES ====================
 
-    for (const auto &[node_id, node] : nodes)
+// Indexed 4-ary min-heap of (key, node) over dense node indices. Each node
+// appears at most once; push() inserts it or lowers its key in place
+// (decrease-key), so the heap never holds stale entries and stays as small
+// as the search frontier. Ties are broken by node index, as with
+// std::pair ordering. The 4-ary layout keeps a node's children in one or two
+// cache lines and halves the tree height of a binary heap.
+class IndexedHeap
+{
+public:
+    // Size the position table for n nodes and empty the heap
+    void resize(int n)
     {
-        if (graph.find(node_id) == graph.end())
-            continue;
-
-        double dist = haversine(lat, lon, node.lat, node.lon);
-        distances.push_back({dist, node_id});
+        if (pos.size() != (size_t)n)
+        {
+            pos.assign(n, -1);
+            items.clear();
+        }
+        else
+        {
+            clear();
+        }
     }
 
-    int k_safe = std::min(k, (int)distances.size());
-    if (k_safe == 0)
-        return {};
-
-    std::nth_element(distances.begin(), distances.begin() + k_safe - 1, distances.end());
-
-    std::vector<long> result;
-    for (int i = 0; i < k_safe; i++)
+    // O(entries still queued): only their positions need resetting
+    void clear()
     {
-        result.push_back(distances[i].second);
+        for (const auto &item : items)
+            pos[item.second] = -1;
+        items.clear();
     }
 
-    return result;
-}
-
-// ==================== IMPROVED SNAPPING & PATH FUNCTIONS ====================
+    bool empty() const { return items.empty(); }
+    size_t size() const { return items.size(); }
+    bool contains(int node) const { return pos[node] != -1; }
+    int top() const { return items.front().second; }
+    double top_key() const { return items.front().first; }
 
-long find_best_snap_node_fast(double lat, double lon)
-{
-    if (kdtree_root)
+    // Insert node, or lower its key if it is queued with a larger one
+    void push(int node, double key)
     {
-        long best_id = -1;
-        double best_dist = std::numeric_limits<double>::max();
-        kdtree_nearest_helper(kdtree_root, lat, lon, best_id, best_dist);
-
-        if (best_id != -1)
+        int i = pos[node];
+        if (i == -1)
         {
-            return best_id;
+            i = (int)items.size();
+            items.push_back({key, node});
         }
-    }
-
-    long best_node = -1;
-    double best_dist = std::numeric_limits<double>::max();
-
-    for (const auto &[node_id, node] : nodes)
-    {
-        if (graph.find(node_id) == graph.end() || graph[node_id].empty())
+        else if (key < items[i].first)
         {
-            continue;
+            items[i].first = key;
         }
-
-        double dist = haversine(lat, lon, node.lat, node.lon);
-        if (dist < best_dist)
+        else
         {
-            best_dist = dist;
-            best_node = node_id;
+            return;
         }
+        sift_up(i);
     }
 
-    return best_node;
-}
-
-// ---------- COMPONENTS / CONNECTIVITY ----------
-void compute_connected_components()
-{
-    node_component.clear();
-    int comp_id = 0;
-    std::vector<long> stack;
-    for (const auto &p : nodes)
+    int pop()
     {
-        long nid = p.first;
-        if (node_component.find(nid) != node_component.end())
-            continue;
-        if (graph.find(nid) == graph.end() || graph[nid].empty())
+        int node = items.front().second;
+        pos[node] = -1;
+        if (items.size() > 1)
         {
-            node_component[nid] = -1; // isolated
-            continue;
+            items.front() = items.back();
+            items.pop_back();
+            sift_down(0);
         }
-        comp_id++;
-        stack.clear();
-        stack.push_back(nid);
-        node_component[nid] = comp_id;
-        while (!stack.empty())
+        else
         {
-            long cur = stack.back();
-            stack.pop_back();
-            if (graph.find(cur) == graph.end())
-                continue;
-            for (auto &e : graph[cur])
-            {
-                long nb = e.first;
-                if (node_component.find(nb) == node_component.end())
-                {
-                    node_component[nb] = comp_id;
-                    stack.push_back(nb);
-                }
-            }
+            items.pop_back();
         }
+        return node;
     }
-    std::cerr << "Computed components, found " << comp_id << " components (isolated marked -1)\n";
-}
 
-long find_nearest_in_main_component(double lat, double lon)
-{
-    // find component frequencies
-    std::unordered_map<int, int> comp_count;
-    for (auto &p : node_component)
+private:
+    static constexpr int ARITY = 4;
+    std::vector<std::pair<double, int>> items; // (key, node)
+    std::vector<int> pos;                      // node -> index in items, -1 if absent
+
+    void sift_up(int i)
     {
-        if (p.second > 0)
-            comp_count[p.second]++;
-    }
-    int main_comp = -1;
-    int maxc = 0;
-    for (auto &q : comp_count)
-        if (q.second > maxc)
+        auto item = items[i];
+        while (i > 0)
         {
-            maxc = q.second;
-            main_comp = q.first;
+            int parent = (i - 1) / ARITY;
+            if (!(item < items[parent]))
+                break;
+            items[i] = items[parent];
+            pos[items[i].second] = i;
+            i = parent;
         }
-    if (main_comp == -1)
-        return find_best_snap_node_fast(lat, lon);
+        items[i] = item;
+        pos[item.second] = i;
+    }
 
-    // search nearest among nodes in main_comp (linear but OK for snapping)
-    long best = -1;
-    double bd = std::numeric_limits<double>::max();
-    for (auto &p : nodes)
+    void sift_down(int i)
     {
-        long nid = p.first;
-        if (node_component.find(nid) == node_component.end())
-            continue;
-        if (node_component[nid] != main_comp)
-            continue;
-        double d = haversine(lat, lon, p.second.lat, p.second.lon);
-        if (d < bd)
+        auto item = items[i];
+        const int n = (int)items.size();
+        while (true)
         {
-            bd = d;
-            best = nid;
+            int first = i * ARITY + 1;
+            if (first >= n)
+                break;
+            int best = first;
+            int last = std::min(first + ARITY, n);
+            for (int c = first + 1; c < last; c++)
+                if (items[c] < items[best])
+                    best = c;
+            if (!(items[best] < item))
+                break;
+            items[i] = items[best];
+            pos[items[i].second] = i;
+            i = best;
         }
+        items[i] = item;
+        pos[item.second] = i;
     }
-    return best;
+};
+
+// Integer-weight searches measure travel time in ticks of 1/10 s. Each edge
+// weight is rounded down, so a tick distance never exceeds the true one and
+// undershoots it by less than one tick per edge on the path.
+const double WEIGHT_TICKS_PER_SECOND = 10.0;
+
+uint32_t weight_ticks(double seconds)
+{
+    return (uint32_t)(seconds * WEIGHT_TICKS_PER_SECOND);
 }
 
-void snap_all_students_fast()
+// Monotone radix heap over 32-bit keys: every key pushed must be at least the
+// last key popped, as in Dijkstra with nonnegative integer weights. Bucket 0
+// holds keys equal to the last popped key, bucket b > 0 the keys whose highest
+// bit differing from it is b - 1. When bucket 0 runs dry the first nonempty
+// bucket is redistributed around its minimum; each entry moves to a lower
+// bucket at most 32 times, so operations are amortised O(log C) for a largest
+// edge weight C, with no comparisons between unrelated keys. Entries are not
+// indexed: a node may be queued more than once and stale entries must be
+// skipped by the caller.
+class RadixHeap
 {
-    std::cout << "\n⚡ Snapping " << students.size() << " students to road network..." << std::endl;
+public:
+    bool empty() const { return count == 0; }
 
-    auto start = std::chrono::high_resolution_clock::now();
-    int snapped = 0;
-    int failed = 0;
+    void clear()
+    {
+        for (auto &bucket : buckets)
+            bucket.clear();
+        count = 0;
+        last = 0;
+    }
 
-    for (auto &student : students)
+    void push(uint32_t key, int node)
     {
-        student.snapped_node_id = find_best_snap_node_fast(student.lat, student.lon);
+        buckets[bucket_of(key)].push_back({key, node});
+        count++;
+    }
 
-        // fallback: avoid snapping into isolated or tiny components
-        if (student.snapped_node_id != -1)
+    std::pair<uint32_t, int> pop()
+    {
+        if (buckets[0].empty())
         {
-            int comp = node_component.count(student.snapped_node_id) ? node_component[student.snapped_node_id] : -1;
-            if (comp <= 0)
-            { // isolated or not in main comp
-                long alt = find_nearest_in_main_component(student.lat, student.lon);
-                if (alt != -1)
-                {
-                    student.snapped_node_id = alt;
-                }
-            }
+            int b = 1;
+            while (buckets[b].empty())
+                b++;
+            uint32_t lowest = buckets[b].front().first;
+            for (const auto &item : buckets[b])
+                lowest = std::min(lowest, item.first);
+            last = lowest;
+            for (const auto &item : buckets[b])
+                buckets[bucket_of(item.first)].push_back(item);
+            buckets[b].clear();
         }
+        auto item = buckets[0].back();
+        buckets[0].pop_back();
+        count--;
+        return item;
+    }
 
-        if (student.snapped_node_id == -1)
-        {
-            failed++;
-        }
-        else
-        {
-            snapped++;
-        }
+private:
+    std::array<std::vector<std::pair<uint32_t, int>>, 33> buckets;
+    uint32_t last = 0;
+    size_t count = 0;
 
-        if (snapped % 250 == 0)
+    int bucket_of(uint32_t key) const
+    {
+        uint32_t diff = key ^ last;
+        int b = 0;
+        while (diff)
         {
-            std::cout << "  ✓ Snapped " << snapped << " students..." << std::endl;
+            diff >>= 1;
+            b++;
         }
+        return b;
     }
+};
 
-    auto end = std::chrono::high_resolution_clock::now();
-    long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
-
-    std::cout << "✅ Snapping complete: " << snapped << " snapped, " << failed << " failed in " << ms << "ms" << std::endl;
-}
-
-std::vector<long> clean_and_validate_path(const std::vector<long> &path)
+// Scratch state of one shortest-path search, indexed by dense node index.
+// An entry is live only while its stamp equals the current generation, so
+// reset() is O(1) and a query pays for the nodes it reaches, not for the
+// size of the graph. Arrays are reallocated only when the node count changes.
+class SearchWorkspace
 {
-    if (path.empty())
-        return {};
+public:
+    IndexedHeap queue; // keyed by distance, or by distance plus potential for A*
+    RadixHeap radix;   // integer-weight searches
 
-    std::vector<long> cleaned_path;
-
-    for (long node_id : path)
+    void reset(int n)
     {
-        if (nodes.find(node_id) == nodes.end())
+        if (stamp.size() != (size_t)n)
         {
-            std::cerr << "⚠️  Path contains non-existent node: " << node_id << std::endl;
-            continue;
+            stamp.assign(n, 0);
+            dist.resize(n);
+            parent.resize(n);
+            aux.resize(n);
+            generation = 0;
+        }
+        if (++generation == 0) // wrapped around: old stamps would look live again
+        {
+            std::fill(stamp.begin(), stamp.end(), 0);
+            generation = 1;
         }
+        reached.clear();
+        queue.resize(n);
+        radix.clear();
+    }
 
-        if (graph.find(node_id) == graph.end() || graph[node_id].empty())
+    bool visited(int u) const { return stamp[u] == generation; }
+    double distance(int u) const { return visited(u) ? dist[u] : std::numeric_limits<double>::max(); }
+    int parent_of(int u) const { return visited(u) ? parent[u] : -1; }
+    int aux_of(int u) const { return visited(u) ? aux[u] : -1; }
+
+    void set(int u, double d, int p, int a = -1)
+    {
+        if (stamp[u] != generation)
         {
-            std::cerr << "⚠️  Path contains disconnected node: " << node_id << std::endl;
-            continue;
+            stamp[u] = generation;
+            reached.push_back(u);
         }
+        dist[u] = d;
+        parent[u] = p;
+        aux[u] = a;
+    }
 
-        cleaned_path.push_back(node_id);
+    void set_aux(int u, int a) { aux[u] = a; }
+
+    // Multiply every reached distance, e.g. to turn ticks into seconds
+    void scale_distances(double factor)
+    {
+        for (int u : reached)
+            dist[u] *= factor;
     }
 
-    return cleaned_path;
-}
+    // Every node given a distance since the last reset, in first-reached order
+    const std::vector<int> &reached_nodes() const { return reached; }
 
-const double MAX_SPEED_MPS = 27.8;
+private:
+    std::vector<uint32_t> stamp;
+    std::vector<double> dist;
+    std::vector<int> parent;
+    std::vector<int> aux;
+    std::vector<int> reached;
+    uint32_t generation = 0;
+};
 
-double heuristic(long node1, long node2)
+// Work done by point-to-point queries, reported by /get-path. Searches add
+// to `settled` so a caller can total several queries.
+struct SearchStats
 {
-    if (nodes.find(node1) == nodes.end() || nodes.find(node2) == nodes.end())
-        return 0.0;
-
-    double distance_meters = haversine(nodes[node1].lat, nodes[node1].lon,
-                                       nodes[node2].lat, nodes[node2].lon);
+    long long settled = 0; // nodes removed from a queue and expanded
+    double distance = std::numeric_limits<double>::max();
+};
 
-    double time_seconds = distance_meters / MAX_SPEED_MPS;
+// A search source (dense index) with the cost already spent reaching it,
+// e.g. an end of the road segment a point was projected onto
+struct SearchSeed
+{
+    int node;
+    double cost;
+};
 
-    return time_seconds;
+// Per-thread workspaces. Slot 0 serves one-directional searches and the
+// forward half of bidirectional ones; slot 1 the backward half. Server
+// threads keep theirs across requests.
+SearchWorkspace &thread_workspace(int slot = 0)
+{
+    thread_local SearchWorkspace workspaces[2];
+    return workspaces[slot];
 }
 
-// ==================== A* BIDIRECTIONAL ALGORITHM ====================
+// ==================== FORWARD DECLARATIONS ====================
 
-struct SearchNode
+std::vector<long> find_k_nearest_nodes(double lat, double lon, int k = 5,
+                                       double max_dist_m = std::numeric_limits<double>::max());
+long find_best_snap_node_fast(double lat, double lon);
+void snap_all_students_fast(int min_component_size = 0, bool segment_snap = false);
+uint64_t hilbert_index(uint32_t x, uint32_t y);
+void count_component_sizes();
+std::vector<long> clean_and_validate_path(const std::vector<long> &path);
+std::vector<long> a_star_bidirectional(long start_node, long goal_node, SearchStats *stats = nullptr);
+std::vector<long> a_star_bidirectional(const std::vector<SearchSeed> &sources, int goal, SearchStats *stats);
+
+// ==================== KD-TREE IMPLEMENTATION ====================
+
+// Implicit KD-tree in one contiguous array. Points are stored as unit
+// vectors on the sphere: the straight-line (chord) distance between two unit
+// vectors grows with their great-circle distance, so the chord-nearest point
+// is the haversine-nearest one, and a splitting plane at coordinate s is at
+// least |q[axis] - s| away in chord length from everything on its far side.
+// Queries thus need no trigonometry beyond converting the query point.
+//
+// The subtree over [lo, hi) is rooted at mid = lo + (hi - lo) / 2 and its
+// children cover [lo, mid) and [mid + 1, hi). Levels alternate between the
+// two coordinate axes along which the points spread most (for a city, the
+// third axis is nearly radial). Ranges of at most LEAF_SIZE points are left
+// unpartitioned and scanned, which saves the deepest levels of recursion.
+// build() partitions in place with nth_element, O(n log n) overall, and
+// forks the top levels onto threads.
+class KDTree
 {
-    long node_id;
-    double g_score;
-    double f_score;
+public:
+    struct Entry
+    {
+        double xyz[3];
+        long node_id;
+    };
 
-    bool operator>(const SearchNode &other) const
+    static void to_unit(double lat, double lon, double xyz[3])
     {
-        return f_score > other.f_score;
+        double phi = lat * M_PI / 180.0, lambda = lon * M_PI / 180.0;
+        xyz[0] = std::cos(phi) * std::cos(lambda);
+        xyz[1] = std::cos(phi) * std::sin(lambda);
+        xyz[2] = std::sin(phi);
     }
-};
 
-std::vector<long> a_star_bidirectional(long start_node, long goal_node)
-{
-    if (start_node == goal_node)
+    void build(const std::vector<KDPoint> &input, int threads = 1)
     {
-        return {start_node};
+        entries.resize(input.size());
+        for (size_t i = 0; i < input.size(); i++)
+        {
+            to_unit(input[i].lat, input[i].lon, entries[i].xyz);
+            entries[i].node_id = input[i].node_id;
+        }
+        choose_axes();
+        clear_tags();
+        int fork_depth = 0;
+        while ((1 << fork_depth) < threads)
+            fork_depth++;
+        build_range(0, entries.size(), 0, fork_depth);
     }
 
-    if (graph.find(start_node) == graph.end() || graph.find(goal_node) == graph.end())
+    // Entries already in tree order, as written by a snapshot
+    void assign(std::vector<Entry> ordered)
     {
-        std::cerr << "⚠️  Start or goal node not in graph" << std::endl;
-        return {};
+        entries = std::move(ordered);
+        choose_axes();
+        clear_tags();
     }
 
-    std::unordered_map<long, double> g_score_forward, g_score_backward;
-    std::unordered_map<long, long> came_from_forward, came_from_backward;
-    std::priority_queue<SearchNode, std::vector<SearchNode>, std::greater<SearchNode>> open_forward, open_backward;
-    std::set<long> closed_forward, closed_backward;
-
-    g_score_forward[start_node] = 0.0;
-    g_score_backward[goal_node] = 0.0;
-
-    SearchNode start_search = {start_node, 0.0, heuristic(start_node, goal_node)};
-    SearchNode goal_search = {goal_node, 0.0, heuristic(goal_node, start_node)};
+    // One non-negative tag per entry, in ordered_entries() order. Each
+    // subtree records its largest tag, so nearest() can skip subtrees that
+    // hold no entry tagged at least min_tag.
+    void set_tags(std::vector<int> entry_tags)
+    {
+        tags = std::move(entry_tags);
+        subtree_max.assign(entries.size(), 0);
+        max_tag_range(0, entries.size());
+    }
 
-    open_forward.push(start_search);
-    open_backward.push(goal_search);
+    void clear()
+    {
+        std::vector<Entry>().swap(entries);
+        clear_tags();
+    }
 
-    long meeting_point = -1;
-    int iterations = 0;
-    const int MAX_ITERATIONS = 100000;
+    bool empty() const { return entries.empty(); }
+    size_t size() const { return entries.size(); }
+    const std::vector<Entry> &ordered_entries() const { return entries; }
 
-    while (!open_forward.empty() && !open_backward.empty() && iterations < MAX_ITERATIONS)
+    // Road vertex of the point nearest to (lat, lon), -1 when empty;
+    // dist_m receives its haversine distance. With min_tag > 0 only entries
+    // tagged at least min_tag are considered (ignored while untagged).
+    long nearest(double lat, double lon, double *dist_m = nullptr, int min_tag = 0) const
     {
-        iterations++;
+        double q[3];
+        to_unit(lat, lon, q);
+        if (tags.empty())
+            min_tag = 0;
+        size_t best = entries.size();
+        double best_chord2 = std::numeric_limits<double>::max();
+        nearest_range(0, entries.size(), 0, q, min_tag, best, best_chord2);
+        if (best == entries.size())
+            return -1;
+        if (dist_m)
+            *dist_m = chord_to_metres(best_chord2);
+        return entries[best].node_id;
+    }
 
-        if (!open_forward.empty())
+    // Up to k distinct road vertices nearest to (lat, lon), closest first, as
+    // (node id, metres); points farther than max_dist_m are ignored. Shape
+    // points share their edge end's id, so a vertex keeps its closest point.
+    std::vector<std::pair<long, double>> nearest_k(double lat, double lon, int k,
+                                                   double max_dist_m = std::numeric_limits<double>::max()) const
+    {
+        std::vector<std::pair<long, double>> result;
+        if (k <= 0 || entries.empty())
+            return result;
+
+        double q[3];
+        to_unit(lat, lon, q);
+        double radius_chord2 = std::numeric_limits<double>::max();
+        if (max_dist_m < M_PI * 6371000)
         {
-            auto current_search = open_forward.top();
-            open_forward.pop();
+            double chord = 2 * std::sin(max_dist_m / (2 * 6371000));
+            radius_chord2 = chord * chord;
+        }
 
-            if (closed_forward.find(current_search.node_id) != closed_forward.end())
-            {
-                continue;
-            }
-            closed_forward.insert(current_search.node_id);
+        std::vector<std::pair<double, long>> heap; // max-heap on chord^2
+        heap.reserve(k);
+        nearest_k_range(0, entries.size(), 0, q, (size_t)k, radius_chord2, heap);
 
-            if (closed_backward.find(current_search.node_id) != closed_backward.end())
-            {
-                meeting_point = current_search.node_id;
-                break;
-            }
+        std::sort(heap.begin(), heap.end());
+        result.reserve(heap.size());
+        for (const auto &[chord2, node_id] : heap)
+            result.push_back({node_id, chord_to_metres(chord2)});
+        return result;
+    }
 
-            if (graph.find(current_search.node_id) != graph.end())
-            {
-                for (const auto &[neighbor, edge_weight] : graph[current_search.node_id])
-                {
-                    double tentative_g = g_score_forward[current_search.node_id] + edge_weight;
+    static double chord_to_metres(double chord2)
+    {
+        return 2 * 6371000 * std::asin(std::min(1.0, std::sqrt(chord2) / 2));
+    }
 
-                    if (g_score_forward.find(neighbor) == g_score_forward.end() ||
-                        tentative_g < g_score_forward[neighbor])
-                    {
+private:
+    static constexpr size_t PARALLEL_CUTOFF = 1 << 15; // smaller subtrees are built inline
+    static constexpr size_t LEAF_SIZE = 8;
 
-                        g_score_forward[neighbor] = tentative_g;
-                        came_from_forward[neighbor] = current_search.node_id;
+    std::vector<Entry> entries;
+    int axes[2] = {0, 1};
+    std::vector<int> tags;        // per entry, see set_tags()
+    std::vector<int> subtree_max; // largest tag in the subtree rooted at each entry
 
-                        double f = tentative_g + heuristic(neighbor, goal_node);
-                        open_forward.push({neighbor, tentative_g, f});
-                    }
-                }
-            }
-        }
+    void clear_tags()
+    {
+        std::vector<int>().swap(tags);
+        std::vector<int>().swap(subtree_max);
+    }
 
-        if (!open_backward.empty())
-        {
-            auto current_search = open_backward.top();
-            open_backward.pop();
+    int max_tag_range(size_t lo, size_t hi)
+    {
+        if (lo >= hi)
+            return 0;
+        size_t mid = lo + (hi - lo) / 2;
+        int m = 0;
+        if (hi - lo <= LEAF_SIZE)
+            m = *std::max_element(tags.begin() + lo, tags.begin() + hi);
+        else
+            m = std::max({tags[mid], max_tag_range(lo, mid), max_tag_range(mid + 1, hi)});
+        subtree_max[mid] = m;
+        return m;
+    }
 
-            if (closed_backward.find(current_search.node_id) != closed_backward.end())
-            {
-                continue;
-            }
-            closed_backward.insert(current_search.node_id);
+    static double chord2(const double a[3], const double b[3])
+    {
+        double dx = a[0] - b[0], dy = a[1] - b[1], dz = a[2] - b[2];
+        return dx * dx + dy * dy + dz * dz;
+    }
 
-            if (closed_forward.find(current_search.node_id) != closed_forward.end())
+    void choose_axes()
+    {
+        double lo[3], hi[3];
+        for (int k = 0; k < 3; k++)
+        {
+            lo[k] = std::numeric_limits<double>::max();
+            hi[k] = std::numeric_limits<double>::lowest();
+        }
+        for (const Entry &e : entries)
+        {
+            for (int k = 0; k < 3; k++)
             {
-                meeting_point = current_search.node_id;
-                break;
+                lo[k] = std::min(lo[k], e.xyz[k]);
+                hi[k] = std::max(hi[k], e.xyz[k]);
             }
+        }
+        int order[3] = {0, 1, 2};
+        std::sort(order, order + 3, [&](int a, int b)
+                  { return hi[a] - lo[a] > hi[b] - lo[b]; });
+        axes[0] = order[0];
+        axes[1] = order[1];
+    }
+
+    void build_range(size_t lo, size_t hi, int level, int fork_depth)
+    {
+        if (hi - lo <= LEAF_SIZE)
+            return;
+        size_t mid = lo + (hi - lo) / 2;
+        int axis = axes[level];
+        std::nth_element(entries.begin() + lo, entries.begin() + mid, entries.begin() + hi,
+                         [axis](const Entry &a, const Entry &b)
+                         { return a.xyz[axis] < b.xyz[axis]; });
+
+        if (fork_depth > 0 && hi - lo >= PARALLEL_CUTOFF)
+        {
+            std::thread left([this, lo, mid, level, fork_depth]
+                             { build_range(lo, mid, level ^ 1, fork_depth - 1); });
+            build_range(mid + 1, hi, level ^ 1, fork_depth - 1);
+            left.join();
+        }
+        else
+        {
+            build_range(lo, mid, level ^ 1, 0);
+            build_range(mid + 1, hi, level ^ 1, 0);
+        }
+    }
 
-            if (graph.find(current_search.node_id) != graph.end())
+    void nearest_range(size_t lo, size_t hi, int level, const double q[3], int min_tag,
+                       size_t &best, double &best_chord2) const
+    {
+        if (lo >= hi)
+            return;
+        size_t mid = lo + (hi - lo) / 2;
+        if (min_tag > 0 && subtree_max[mid] < min_tag)
+            return;
+        if (hi - lo <= LEAF_SIZE)
+        {
+            for (size_t i = lo; i < hi; i++)
             {
-                for (const auto &[neighbor, edge_weight] : graph[current_search.node_id])
+                double d2 = chord2(q, entries[i].xyz);
+                if (d2 < best_chord2 && (min_tag <= 0 || tags[i] >= min_tag))
                 {
-                    double tentative_g = g_score_backward[current_search.node_id] + edge_weight;
+                    best_chord2 = d2;
+                    best = i;
+                }
+            }
+            return;
+        }
+        const Entry &e = entries[mid];
 
-                    if (g_score_backward.find(neighbor) == g_score_backward.end() ||
-                        tentative_g < g_score_backward[neighbor])
-                    {
+        double d2 = chord2(q, e.xyz);
+        if (d2 < best_chord2 && (min_tag <= 0 || tags[mid] >= min_tag))
+        {
+            best_chord2 = d2;
+            best = mid;
+        }
 
-                        g_score_backward[neighbor] = tentative_g;
-                        came_from_backward[neighbor] = current_search.node_id;
+        double diff = q[axes[level]] - e.xyz[axes[level]];
+        if (diff < 0)
+            nearest_range(lo, mid, level ^ 1, q, min_tag, best, best_chord2);
+        else
+            nearest_range(mid + 1, hi, level ^ 1, q, min_tag, best, best_chord2);
 
-                        double f = tentative_g + heuristic(neighbor, start_node);
-                        open_backward.push({neighbor, tentative_g, f});
-                    }
-                }
-            }
+        if (diff * diff < best_chord2)
+        {
+            if (diff < 0)
+                nearest_range(mid + 1, hi, level ^ 1, q, min_tag, best, best_chord2);
+            else
+                nearest_range(lo, mid, level ^ 1, q, min_tag, best, best_chord2);
         }
     }
 
-    if (meeting_point != -1)
+    void nearest_k_range(size_t lo, size_t hi, int level, const double q[3], size_t k,
+                         double radius_chord2, std::vector<std::pair<double, long>> &heap) const
     {
-        std::vector<long> path_forward, path_backward;
-
-        long node = meeting_point;
-        while (came_from_forward.find(node) != came_from_forward.end())
+        if (lo >= hi)
+            return;
+        if (hi - lo <= LEAF_SIZE)
         {
-            path_forward.push_back(node);
-            node = came_from_forward[node];
+            for (size_t i = lo; i < hi; i++)
+            {
+                double d2 = chord2(q, entries[i].xyz);
+                if (d2 <= (heap.size() == k ? std::min(radius_chord2, heap.front().first) : radius_chord2))
+                    offer(heap, k, d2, entries[i].node_id);
+            }
+            return;
         }
-        path_forward.push_back(start_node);
-        std::reverse(path_forward.begin(), path_forward.end());
+        size_t mid = lo + (hi - lo) / 2;
+        const Entry &e = entries[mid];
+
+        double d2 = chord2(q, e.xyz);
+        double bound = heap.size() == k ? std::min(radius_chord2, heap.front().first) : radius_chord2;
+        if (d2 <= bound)
+            offer(heap, k, d2, e.node_id);
+
+        double diff = q[axes[level]] - e.xyz[axes[level]];
+        if (diff < 0)
+            nearest_k_range(lo, mid, level ^ 1, q, k, radius_chord2, heap);
+        else
+            nearest_k_range(mid + 1, hi, level ^ 1, q, k, radius_chord2, heap);
 
-        node = meeting_point;
-        while (came_from_backward.find(node) != came_from_backward.end())
+        bound = heap.size() == k ? std::min(radius_chord2, heap.front().first) : radius_chord2;
+        if (diff * diff <= bound)
         {
-            path_backward.push_back(node);
-            node = came_from_backward[node];
+            if (diff < 0)
+                nearest_k_range(mid + 1, hi, level ^ 1, q, k, radius_chord2, heap);
+            else
+                nearest_k_range(lo, mid, level ^ 1, q, k, radius_chord2, heap);
         }
-        path_backward.push_back(goal_node);
-
-        std::vector<long> full_path = path_forward;
-        full_path.insert(full_path.end(), path_backward.begin(), path_backward.end());
+    }
 
-        return full_path;
+    // Keeps the k closest distinct node ids; k is small, so the duplicate
+    // check is a scan of the heap
+    static void offer(std::vector<std::pair<double, long>> &heap, size_t k, double d2, long node_id)
+    {
+        for (auto &item : heap)
+        {
+            if (item.second != node_id)
+                continue;
+            if (d2 < item.first)
+            {
+                item.first = d2;
+                std::make_heap(heap.begin(), heap.end());
+            }
+            return;
+        }
+        if (heap.size() < k)
+        {
+            heap.push_back({d2, node_id});
+            std::push_heap(heap.begin(), heap.end());
+        }
+        else if (d2 < heap.front().first)
+        {
+            std::pop_heap(heap.begin(), heap.end());
+            heap.back() = {d2, node_id};
+            std::push_heap(heap.begin(), heap.end());
+        }
     }
+};
 
-    return {};
-}
+KDTree kdtree; // connected road vertices plus shape points, see road_snap_points()
 
-// ==================== OVERPASS API INTEGRATION ====================
+long find_nearest_node(double lat, double lon)
+{
+    return kdtree.nearest(lat, lon);
+}
 
-static size_t write_callback(void *contents, size_t size, size_t nmemb, void *userp)
+// Up to k nearest distinct road vertices, closest first, optionally within
+// max_dist_m metres
+std::vector<long> find_k_nearest_nodes(double lat, double lon, int k, double max_dist_m)
 {
-    ((std::string *)userp)->append((char *)contents, size * nmemb);
-    return size * nmemb;
+    std::vector<long> result;
+    for (const auto &[node_id, dist] : kdtree.nearest_k(lat, lon, k, max_dist_m))
+        result.push_back(node_id);
+    return result;
 }
 
-std::string fetch_overpass_data(double min_lat, double min_lon, double max_lat, double max_lon, const std::string &graph_detail = "medium")
+// ==================== SEGMENT R-TREE ====================
+
+// Static R-tree over road segments (the pieces of every edge's polyline),
+// bulk-loaded with Sort-Tile-Recursive: segments are sorted into vertical
+// slices by centre longitude, each slice by centre latitude, and packed
+// NODE_SIZE to a leaf. Each upper level packs NODE_SIZE consecutive boxes of
+// the level below, so children are contiguous ranges and no pointers are
+// stored. Queries run best-first in a local flat-earth frame around the
+// query point (metres, longitude scaled by cos(latitude)), which is accurate
+// to well under a metre over the length of a city road segment.
+class SegmentRTree
 {
-    std::cout << "Fetching real road data from Overpass API (detail: " << graph_detail << ")..." << std::endl;
+public:
+    struct Segment
+    {
+        double lat1, lon1, lat2, lon2;
+        int edge;  // road_graph edge whose geometry this piece belongs to
+        int piece; // 0 = from the edge's source to its first shape point
+    };
 
-    std::string highway_types;
-    if (graph_detail == "low")
+    struct Hit
     {
-        highway_types = "primary|secondary|tertiary";
-        std::cout << "📉 Low detail: Major roads only (fastest)" << std::endl;
-    }
-    else if (graph_detail == "high")
+        int edge = -1;
+        int piece = 0;
+        double t = 0; // projection along the segment, 0 at (lat1, lon1)
+        double lat = 0;
+        double lon = 0;
+    };
+
+    void build(std::vector<Segment> input)
     {
-        highway_types = "motorway|trunk|primary|secondary|tertiary|residential|living_street|service|unclassified";
-        std::cout << "📈 High detail: All roads (most accurate)" << std::endl;
+        segments = std::move(input);
+        levels.clear();
+        const size_t n = segments.size();
+        if (n == 0)
+            return;
+
+        size_t leaves = (n + NODE_SIZE - 1) / NODE_SIZE;
+        size_t slices = (size_t)std::ceil(std::sqrt((double)leaves));
+        size_t slice_size = (leaves + slices - 1) / slices * NODE_SIZE;
+        std::sort(segments.begin(), segments.end(), [](const Segment &a, const Segment &b)
+                  { return a.lon1 + a.lon2 < b.lon1 + b.lon2; });
+        for (size_t lo = 0; lo < n; lo += slice_size)
+            std::sort(segments.begin() + lo, segments.begin() + std::min(n, lo + slice_size),
+                      [](const Segment &a, const Segment &b)
+                      { return a.lat1 + a.lat2 < b.lat1 + b.lat2; });
+
+        levels.emplace_back();
+        levels[0].reserve(n);
+        for (const Segment &seg : segments)
+            levels[0].push_back({std::min(seg.lat1, seg.lat2), std::min(seg.lon1, seg.lon2),
+                                 std::max(seg.lat1, seg.lat2), std::max(seg.lon1, seg.lon2)});
+        while (levels.back().size() > 1)
+        {
+            const std::vector<Box> &below = levels.back();
+            std::vector<Box> level((below.size() + NODE_SIZE - 1) / NODE_SIZE);
+            for (size_t i = 0; i < level.size(); i++)
+            {
+                Box box = below[i * NODE_SIZE];
+                for (size_t c = i * NODE_SIZE + 1; c < std::min(below.size(), (i + 1) * NODE_SIZE); c++)
+                {
+                    box.min_lat = std::min(box.min_lat, below[c].min_lat);
+                    box.min_lon = std::min(box.min_lon, below[c].min_lon);
+                    box.max_lat = std::max(box.max_lat, below[c].max_lat);
+                    box.max_lon = std::max(box.max_lon, below[c].max_lon);
+                }
+                level[i] = box;
+            }
+            levels.push_back(std::move(level));
+        }
     }
-    else
+
+    void clear()
     {
-        highway_types = "primary|secondary|tertiary|residential|living_street|service|unclassified";
-        std::cout << "📊 Medium detail: Most roads (balanced)" << std::endl;
+        std::vector<Segment>().swap(segments);
+        levels.clear();
     }
 
-    std::stringstream query_stream;
-    query_stream << std::fixed << std::setprecision(8);
-    query_stream << "[out:json][timeout:60];";
-    query_stream << "(";
-    query_stream << "way[highway~\"" << highway_types << "\"]";
-    query_stream << "(" << min_lat << "," << min_lon << "," << max_lat << "," << max_lon << ");";
-    query_stream << "node(w);";
-    query_stream << ");";
-    query_stream << "out body;";
-    std::string query = query_stream.str();
-
-    std::cout << "Query: " << query << std::endl;
+    bool empty() const { return segments.empty(); }
+    size_t size() const { return segments.size(); }
 
-    CURL *curl = curl_easy_init();
-    if (!curl)
+    // Nearest segment to (lat, lon) and the projection onto it
+    bool nearest(double lat, double lon, Hit &hit) const
     {
-        std::cerr << "Failed to initialize curl" << std::endl;
-        return "{}";
+        return nearest(lat, lon, hit, [](int)
+                       { return true; });
     }
 
-    char *encoded_query = curl_easy_escape(curl, query.c_str(), query.length());
-    std::string url = "https://overpass-api.de/api/interpreter?data=" + std::string(encoded_query);
-    curl_free(encoded_query);
+    // Nearest segment whose edge passes accept(edge). The filter is only
+    // consulted for segments closer than the best so far.
+    template <typename Accept>
+    bool nearest(double lat, double lon, Hit &hit, Accept accept) const
+    {
+        if (segments.empty())
+            return false;
+
+        const double ky = 6371000.0 * M_PI / 180.0;
+        const double kx = ky * std::cos(lat * M_PI / 180.0);
+        auto box_dist2 = [&](const Box &b)
+        {
+            double dx = std::max({0.0, b.min_lon - lon, lon - b.max_lon}) * kx;
+            double dy = std::max({0.0, b.min_lat - lat, lat - b.max_lat}) * ky;
+            return dx * dx + dy * dy;
+        };
 
-    std::string response_data;
+        double best = std::numeric_limits<double>::max();
+        auto visit_segment = [&](size_t i)
+        {
+            const Segment &seg = segments[i];
+            double ax = (seg.lon1 - lon) * kx, ay = (seg.lat1 - lat) * ky;
+            double bx = (seg.lon2 - lon) * kx, by = (seg.lat2 - lat) * ky;
+            double dx = bx - ax, dy = by - ay;
+            double len2 = dx * dx + dy * dy;
+            double t = len2 > 0 ? std::clamp(-(ax * dx + ay * dy) / len2, 0.0, 1.0) : 0.0;
+            double px = ax + t * dx, py = ay + t * dy;
+            double d2 = px * px + py * py;
+            if (d2 < best && accept(seg.edge))
+            {
+                best = d2;
+                hit.edge = seg.edge;
+                hit.piece = seg.piece;
+                hit.t = t;
+                hit.lat = seg.lat1 + t * (seg.lat2 - seg.lat1);
+                hit.lon = seg.lon1 + t * (seg.lon2 - seg.lon1);
+            }
+        };
+
+        // Boxes as (squared lower bound, level, index), nearest first
+        using Pending = std::tuple<double, int, size_t>;
+        thread_local std::vector<Pending> heap;
+        heap.clear();
+        heap.push_back({0.0, (int)levels.size() - 1, 0});
+        while (!heap.empty())
+        {
+            std::pop_heap(heap.begin(), heap.end(), std::greater<Pending>());
+            auto [bound, level, index] = heap.back();
+            heap.pop_back();
+            if (bound >= best)
+                break;
+            if (level == 0)
+            {
+                visit_segment(index);
+                continue;
+            }
 
-    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response_data);
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT, 60L);
-    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+            const std::vector<Box> &below = levels[level - 1];
+            for (size_t c = index * NODE_SIZE; c < std::min(below.size(), (index + 1) * NODE_SIZE); c++)
+            {
+                if (level == 1)
+                {
+                    visit_segment(c);
+                    continue;
+                }
+                double d2 = box_dist2(below[c]);
+                if (d2 < best)
+                {
+                    heap.push_back({d2, level - 1, c});
+                    std::push_heap(heap.begin(), heap.end(), std::greater<Pending>());
+                }
+            }
+        }
+        return hit.edge != -1;
+    }
 
-    CURLcode res = curl_easy_perform(curl);
+private:
+    static constexpr size_t NODE_SIZE = 8;
 
-    if (res != CURLE_OK)
+    struct Box
     {
-        std::cerr << "curl_easy_perform() failed: " << curl_easy_strerror(res) << std::endl;
-        curl_easy_cleanup(curl);
-        return "{}";
-    }
+        double min_lat, min_lon, max_lat, max_lon;
+    };
 
-    long http_code = 0;
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
-    curl_easy_cleanup(curl);
+    std::vector<Segment> segments;     // in leaf order
+    std::vector<std::vector<Box>> levels; // levels[0]: one box per segment; levels.back(): the root
+};
+
+SegmentRTree segment_index; // pieces of every road, see road_segments()
+
+// Source vertex of edge e
+int edge_source(const RoadGraph &g, int e)
+{
+    return (int)(std::upper_bound(g.offsets.begin(), g.offsets.end(), e) - g.offsets.begin()) - 1;
+}
+
+// Projects (lat, lon) onto the nearest road segment and fills snap with the
+// road's ends, the offsets along it and the travel time to and from each
+// end. Weights are spread along an edge in proportion to length. With a
+// component id, only roads with an end in that component are considered.
+bool snap_to_segment(double lat, double lon, EdgeSnap &snap, int component)
+{
+    SegmentRTree::Hit hit;
+    auto in_component = [&](int e)
+    {
+        return component == 0 || node_component[edge_source(road_graph, e)] == component ||
+               node_component[road_graph.targets[e]] == component;
+    };
+    if (!segment_index.nearest(lat, lon, hit, in_component))
+        return false;
 
-    if (http_code != 200)
+    const RoadGraph &g = road_graph;
+    const double INF = std::numeric_limits<double>::max();
+    int e = hit.edge;
+    int u = edge_source(g, e), v = g.targets[e];
+    int shape_begin = g.has_geometry() ? g.shape_offsets[e] : 0;
+    int shape_end = g.has_geometry() ? g.shape_offsets[e + 1] : 0;
+    int pieces = shape_end - shape_begin + 1;
+
+    // Length of each piece of the polyline u -> shape points -> v
+    double offset = 0, total = 0;
+    double prev_lat = g.lat[u], prev_lon = g.lon[u];
+    for (int p = 0; p < pieces; p++)
     {
-        std::cerr << "HTTP error: " << http_code << std::endl;
-        return "{}";
+        double next_lat = p + 1 < pieces ? g.shape_lat[shape_begin + p] : g.lat[v];
+        double next_lon = p + 1 < pieces ? g.shape_lon[shape_begin + p] : g.lon[v];
+        double length = haversine(prev_lat, prev_lon, next_lat, next_lon);
+        if (p < hit.piece)
+            offset += length;
+        else if (p == hit.piece)
+            offset += length * hit.t;
+        total += length;
+        prev_lat = next_lat;
+        prev_lon = next_lon;
     }
 
-    std::cout << "Successfully fetched " << response_data.length() << " bytes from Overpass API" << std::endl;
-    return response_data;
+    int reverse = -1;
+    for (int r = g.offsets[v]; r < g.offsets[v + 1] && reverse == -1; r++)
+        if (g.targets[r] == u && (!g.has_geometry() || g.shape_offsets[r + 1] - g.shape_offsets[r] == pieces - 1))
+            reverse = r;
+
+    double fraction = total > 0 ? offset / total : 0.0;
+    snap.start_node = g.osm_ids[u];
+    snap.end_node = g.osm_ids[v];
+    snap.edge = e;
+    snap.reverse_edge = reverse;
+    snap.piece = hit.piece;
+    snap.offset_start_m = offset;
+    snap.offset_end_m = total - offset;
+    snap.lat = hit.lat;
+    snap.lon = hit.lon;
+    snap.distance_m = haversine(lat, lon, hit.lat, hit.lon);
+    snap.seconds_from_start = g.weights[e] * fraction;
+    snap.seconds_to_end = g.weights[e] * (1 - fraction);
+    snap.seconds_to_start = reverse != -1 ? g.weights[reverse] * fraction : INF;
+    snap.seconds_from_end = reverse != -1 ? g.weights[reverse] * (1 - fraction) : INF;
+    return true;
 }
 
-double get_default_speed(const std::string &highway_type)
+// Road geometry from an edge snap's projection to one of its ends (excluded)
+std::vector<std::pair<double, double>> edge_snap_geometry(const EdgeSnap &snap, long towards)
 {
-    if (highway_type == "motorway")
-        return 100.0;
-    if (highway_type == "trunk")
-        return 90.0;
-    if (highway_type == "primary")
-        return 80.0;
-    if (highway_type == "secondary")
-        return 60.0;
-    if (highway_type == "tertiary")
-        return 50.0;
-    if (highway_type == "residential")
-        return 30.0;
-    if (highway_type == "living_street")
-        return 20.0;
-    if (highway_type == "service")
-        return 20.0;
-    if (highway_type == "unclassified")
-        return 40.0;
-    return 30.0;
+    const RoadGraph &g = road_graph;
+    std::vector<std::pair<double, double>> coords = {{snap.lat, snap.lon}};
+    if (!g.has_geometry())
+        return coords;
+    int shape_begin = g.shape_offsets[snap.edge];
+    int shape_end = g.shape_offsets[snap.edge + 1];
+    if (towards == snap.end_node)
+        for (int s = shape_begin + snap.piece; s < shape_end; s++)
+            coords.push_back({g.shape_lat[s], g.shape_lon[s]});
+    else
+        for (int s = shape_begin + snap.piece - 1; s >= shape_begin; s--)
+            coords.push_back({g.shape_lat[s], g.shape_lon[s]});
+    return coords;
 }
 
-void build_graph_from_overpass(const json &osm_data)
+// ==================== IMPROVED SNAPPING & PATH FUNCTIONS ====================
+
+long find_best_snap_node_fast(double lat, double lon)
 {
-    std::cout << "Building graph from real OSM node/way data..." << std::endl;
+    if (!kdtree.empty())
+        return kdtree.nearest(lat, lon);
 
-    nodes.clear();
-    graph.clear();
+    long best_node = -1;
+    double best_dist = std::numeric_limits<double>::max();
 
-    if (!osm_data.contains("elements") || osm_data["elements"].empty())
+    for (int u = 0; u < road_graph.num_nodes(); u++)
     {
-        std::cerr << "ERROR: No valid elements in OSM data!" << std::endl;
-        return;
-    }
+        if (road_graph.degree(u) == 0)
+        {
+            continue;
+        }
 
-    for (const auto &element : osm_data["elements"])
-    {
-        if (element["type"] == "node")
+        double dist = haversine(lat, lon, road_graph.lat[u], road_graph.lon[u]);
+        if (dist < best_dist)
         {
-            long id = element["id"];
-            double lat = element["lat"];
-            double lon = element["lon"];
-            nodes[id] = {id, lat, lon};
+            best_dist = dist;
+            best_node = road_graph.osm_ids[u];
         }
     }
-    std::cout << "Stored " << nodes.size() << " unique nodes from OSM data" << std::endl;
 
-    int edge_count = 0;
-    int oneway_count = 0;
+    return best_node;
+}
 
-    for (const auto &element : osm_data["elements"])
+// ---------- COMPONENTS / CONNECTIVITY ----------
+void compute_connected_components()
+{
+    const int n = road_graph.num_nodes();
+    node_component.assign(n, 0); // 0 = not visited yet
+    int comp_id = 0;
+    std::vector<int> stack;
+    for (int u = 0; u < n; u++)
     {
-        if (element["type"] == "way" && element.contains("nodes"))
+        if (node_component[u] != 0)
+            continue;
+        if (road_graph.degree(u) == 0)
         {
-            std::string highway_type = "";
-            bool is_oneway = false;
-            double speed_kmh = 30.0;
-
-            if (element.contains("tags"))
+            node_component[u] = -1; // isolated
+            continue;
+        }
+        comp_id++;
+        stack.clear();
+        stack.push_back(u);
+        node_component[u] = comp_id;
+        while (!stack.empty())
+        {
+            int cur = stack.back();
+            stack.pop_back();
+            for (int e = road_graph.offsets[cur]; e < road_graph.offsets[cur + 1]; e++)
             {
-                const auto &tags = element["tags"];
-
-                if (tags.contains("highway"))
-                {
-                    highway_type = tags["highway"].get<std::string>();
-                    speed_kmh = get_default_speed(highway_type);
-                }
-
-                if (tags.contains("oneway"))
-                {
-                    std::string oneway_val = tags["oneway"].get<std::string>();
-                    is_oneway = (oneway_val == "yes" || oneway_val == "true" || oneway_val == "1");
-                }
-
-                if (tags.contains("maxspeed"))
+                int nb = road_graph.targets[e];
+                if (node_component[nb] == 0)
                 {
-                    std::string maxspeed_str = tags["maxspeed"].get<std::string>();
-                    try
-                    {
-                        speed_kmh = std::stod(maxspeed_str);
-                    }
-                    catch (...)
-                    {
-                    }
+                    node_component[nb] = comp_id;
+                    stack.push_back(nb);
                 }
             }
+        }
+    }
+    std::cerr << "Computed components, found " << comp_id << " components (isolated marked -1)\n";
+    count_component_sizes();
+}
 
-            const auto &way_node_ids = element["nodes"];
-
-            for (size_t i = 0; i < way_node_ids.size() - 1; i++)
-            {
-                long node1_id = way_node_ids[i];
-                long node2_id = way_node_ids[i + 1];
-
-                if (nodes.find(node1_id) != nodes.end() && nodes.find(node2_id) != nodes.end())
-                {
-                    double dist_meters = haversine(
-                        nodes[node1_id].lat, nodes[node1_id].lon,
-                        nodes[node2_id].lat, nodes[node2_id].lon);
+// Vertex count of every component and the largest one, once per graph
+void count_component_sizes()
+{
+    int num_components = 0;
+    for (int comp : node_component)
+        num_components = std::max(num_components, comp);
+    component_size.assign(num_components + 1, 0);
+    for (int comp : node_component)
+        if (comp > 0)
+            component_size[comp]++;
+
+    main_component = -1;
+    for (int comp = 1; comp <= num_components; comp++)
+        if (main_component == -1 || component_size[comp] > component_size[main_component])
+            main_component = comp;
+}
 
-                    double dist_km = dist_meters / 1000.0;
-                    double time_hours = dist_km / speed_kmh;
-                    double time_seconds = time_hours * 3600.0;
-                    double edge_weight = time_seconds;
+int component_of(long node_id)
+{
+    int u = road_graph.index(node_id);
+    return u == -1 ? -1 : node_component[u];
+}
 
-                    if (is_oneway)
-                    {
-                        graph[node1_id].push_back({node2_id, edge_weight});
-                        edge_count++;
-                        oneway_count++;
-                    }
-                    else
-                    {
-                        graph[node1_id].push_back({node2_id, edge_weight});
-                        graph[node2_id].push_back({node1_id, edge_weight});
-                        edge_count += 2;
-                    }
-                }
-            }
-        }
+// Tags every KD-tree entry with the size of its vertex's component, for
+// find_nearest_in_component_of_size(). Run after each (re)build of the tree.
+void tag_kdtree_components()
+{
+    std::vector<int> tags;
+    tags.reserve(kdtree.size());
+    for (const KDTree::Entry &e : kdtree.ordered_entries())
+    {
+        int comp = component_of(e.node_id);
+        tags.push_back(comp > 0 ? component_size[comp] : 0);
     }
+    kdtree.set_tags(std::move(tags));
+}
 
-    std::cout << "Built graph with " << nodes.size() << " nodes and "
-              << edge_count << " directed edges" << std::endl;
-    std::cout << "Found " << oneway_count << " one-way street segments" << std::endl;
+// Nearest road vertex whose component has at least min_size vertices,
+// -1 when there is none
+long find_nearest_in_component_of_size(double lat, double lon, int min_size)
+{
+    return kdtree.nearest(lat, lon, nullptr, std::max(min_size, 1));
+}
 
-    // compute connected components now that graph built
-    compute_connected_components();
+long find_nearest_in_main_component(double lat, double lon)
+{
+    if (main_component == -1)
+        return find_best_snap_node_fast(lat, lon);
+    return find_nearest_in_component_of_size(lat, lon, component_size[main_component]);
 }
 
-void generate_simulated_graph_fallback(double min_lat, double min_lon, double max_lat, double max_lon)
+// Snaps a student to the nearest road vertex and records its distance and
+// component. An isolated vertex is replaced by the nearest one in the main
+// component, and a vertex in a component of fewer than min_component_size
+// vertices by the nearest one in a large enough component. With
+// segment_snap the student is then projected onto the nearest road segment
+// of that component; snapped_node_id becomes the end nearer along the road
+// and the snap distance is measured to the road.
+void snap_student(Student &student, int min_component_size, bool segment_snap)
 {
-    std::cout << "\n=== FALLBACK: Generating simulated road network ===" << std::endl;
+    long node = find_best_snap_node_fast(student.lat, student.lon);
+    int u = node == -1 ? -1 : road_graph.index(node);
+    int comp = u == -1 ? -1 : node_component[u];
+
+    long alt = -1;
+    if (u != -1 && comp <= 0)
+        alt = find_nearest_in_main_component(student.lat, student.lon);
+    else if (comp > 0 && component_size[comp] < min_component_size)
+        alt = find_nearest_in_component_of_size(student.lat, student.lon, min_component_size);
+    if (alt != -1)
+    {
+        node = alt;
+        u = road_graph.index(node);
+        comp = node_component[u];
+    }
 
-    nodes.clear();
-    graph.clear();
+    student.snapped_node_id = node;
+    student.component_id = comp;
+    student.snap_distance_m = u == -1 ? -1 : haversine(student.lat, student.lon, road_graph.lat[u], road_graph.lon[u]);
+    student.edge_snap = EdgeSnap();
 
-    const int GRID_SIZE = 80;
-    double lat_step = (max_lat - min_lat) / GRID_SIZE;
-    double lon_step = (max_lon - min_lon) / GRID_SIZE;
+    EdgeSnap snap;
+    if (segment_snap && comp > 0 && snap_to_segment(student.lat, student.lon, snap, comp))
+    {
+        student.edge_snap = snap;
+        student.snapped_node_id = snap.offset_start_m <= snap.offset_end_m ? snap.start_node : snap.end_node;
+        student.snap_distance_m = snap.distance_m;
+    }
+}
 
-    long node_id = 1;
-    std::vector<std::vector<long>> grid_nodes(GRID_SIZE, std::vector<long>(GRID_SIZE));
+// Snaps a whole batch in one pass. Students are visited in Hilbert order
+// over their bounding box, so consecutive queries walk the same KD-tree
+// paths, in chunks spread over the worker pool; the batch keeps its order.
+// Also assigns each student's allotment_matrix row key. Returns the number
+// of students that could not be snapped.
+int snap_students(std::vector<Student> &batch, int min_component_size, bool segment_snap)
+{
+    const size_t n = batch.size();
+    if (n == 0)
+        return 0;
 
-    for (int i = 0; i < GRID_SIZE; i++)
+    double min_lat = batch[0].lat, max_lat = batch[0].lat;
+    double min_lon = batch[0].lon, max_lon = batch[0].lon;
+    for (const Student &s : batch)
     {
-        for (int j = 0; j < GRID_SIZE; j++)
-        {
-            double lat = min_lat + i * lat_step;
-            double lon = min_lon + j * lon_step;
-            nodes[node_id] = {node_id, lat, lon};
-            grid_nodes[i][j] = node_id;
-            node_id++;
-        }
+        min_lat = std::min(min_lat, s.lat);
+        max_lat = std::max(max_lat, s.lat);
+        min_lon = std::min(min_lon, s.lon);
+        max_lon = std::max(max_lon, s.lon);
     }
+    double lat_span = std::max(max_lat - min_lat, 1e-9);
+    double lon_span = std::max(max_lon - min_lon, 1e-9);
 
-    for (int i = 0; i < GRID_SIZE; i++)
+    // Hilbert key (32 bits on a 2^16 grid) in the high half, student index
+    // in the low half, so a plain integer sort orders the batch
+    std::vector<uint64_t> order(n);
+    for (size_t i = 0; i < n; i++)
     {
-        for (int j = 0; j < GRID_SIZE; j++)
-        {
-            long current = grid_nodes[i][j];
-
-            std::vector<std::pair<int, int>> directions = {
-                {0, 1}, {1, 0}, {1, 1}, {1, -1}, {0, -1}, {-1, 0}, {-1, -1}, {-1, 1}};
+        uint32_t x = (uint32_t)((batch[i].lon - min_lon) / lon_span * 65535.0);
+        uint32_t y = (uint32_t)((batch[i].lat - min_lat) / lat_span * 65535.0);
+        order[i] = hilbert_index(x, y) << 32 | i;
+    }
+    std::sort(order.begin(), order.end());
+
+    const size_t CHUNK = 4096;
+    size_t chunks = (n + CHUNK - 1) / CHUNK;
+    std::vector<int> failed(chunks, 0);
+    parallel_for(chunks, worker_count(chunks), [&](size_t c, int)
+                 {
+                     size_t end = std::min(n, (c + 1) * CHUNK);
+                     for (size_t k = c * CHUNK; k < end; k++)
+                     {
+                         size_t i = order[k] & 0xffffffffu;
+                         Student &student = batch[i];
+                         snap_student(student, min_component_size, segment_snap);
+                         student.row_key = student.edge_snap.valid() ? -2 - (long)i : student.snapped_node_id;
+                         if (student.snapped_node_id == -1)
+                             failed[c]++;
+                     } });
+
+    int total_failed = 0;
+    for (int f : failed)
+        total_failed += f;
+    return total_failed;
+}
 
-            for (const auto &dir : directions)
-            {
-                int ni = i + dir.first;
-                int nj = j + dir.second;
+void snap_all_students_fast(int min_component_size, bool segment_snap)
+{
+    std::cout << "\n⚡ Snapping " << students.size() << " students to road network..." << std::endl;
 
-                if (ni >= 0 && ni < GRID_SIZE && nj >= 0 && nj < GRID_SIZE)
-                {
-                    long neighbor = grid_nodes[ni][nj];
-                    double dist = haversine(nodes[current].lat, nodes[current].lon,
-                                            nodes[neighbor].lat, nodes[neighbor].lon);
+    auto start = std::chrono::high_resolution_clock::now();
+    int failed = snap_students(students, min_component_size, segment_snap);
+    int snapped = (int)students.size() - failed;
+    auto end = std::chrono::high_resolution_clock::now();
+    long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
 
-                    bool exists = false;
-                    for (const auto &edge : graph[current])
-                    {
-                        if (edge.first == neighbor)
-                        {
-                            exists = true;
-                            break;
-                        }
-                    }
-                    if (!exists)
-                    {
-                        graph[current].push_back({neighbor, dist});
-                    }
-                }
+    std::cout << "✅ Snapping complete: " << snapped << " snapped, " << failed << " failed in " << ms << "ms" << std::endl;
+}
+
+std::vector<long> clean_and_validate_path(const std::vector<long> &path)
+{
+    if (path.empty())
+        return {};
+
+    std::vector<long> cleaned_path;
+
+    for (long node_id : path)
+    {
+        int u = road_graph.index(node_id);
+        if (u == -1)
+        {
+            std::cerr << "⚠️  Path contains non-existent node: " << node_id << std::endl;
+            continue;
+        }
+
+        if (road_graph.degree(u) == 0)
+        {
+            std::cerr << "⚠️  Path contains disconnected node: " << node_id << std::endl;
+            continue;
+        }
+
+        cleaned_path.push_back(node_id);
+    }
+
+    return cleaned_path;
+}
+
+// Lower bound on the travel time between two dense road_graph indices: the
+// haversine distance at the graph's fastest edge speed, so it stays
+// admissible whatever maxspeed tags say. Without a speed bound it is zero and
+// A* runs as Dijkstra.
+double heuristic(int node1, int node2)
+{
+    if (road_graph.max_speed_mps <= 0)
+        return 0.0;
+
+    double distance_meters = haversine(road_graph.lat[node1], road_graph.lon[node1],
+                                       road_graph.lat[node2], road_graph.lon[node2]);
+
+    double time_seconds = distance_meters / road_graph.max_speed_mps;
+
+    return time_seconds;
+}
+
+// ==================== A* BIDIRECTIONAL ALGORITHM ====================
+
+// Bidirectional A* with average potentials: forward keys are d_f(v) + p(v),
+// backward keys d_b(v) - p(v), with p(v) = (h(v, goal) - h(start, v)) / 2 and
+// h the haversine time at road_graph.max_speed_mps. Both directions then see
+// the same nonnegative reduced edge costs, so the search may stop as soon as
+// the two queue minima add up to the best start-goal length mu found so far.
+// The backward search follows in-edges, so one-way streets are respected.
+// Without a speed bound the potentials are zero (bidirectional Dijkstra).
+std::vector<long> a_star_bidirectional(long start_node, long goal_node, SearchStats *stats)
+{
+    int start = road_graph.index(start_node);
+    int goal = road_graph.index(goal_node);
+    if (start == -1 || goal == -1)
+    {
+        std::cerr << "⚠️  Start or goal node not in graph" << std::endl;
+        return {};
+    }
+    if (start == goal)
+    {
+        if (stats)
+            stats->distance = 0.0;
+        return {start_node};
+    }
+    return a_star_bidirectional({{start, 0.0}}, goal, stats);
+}
+
+// The same search from the cheapest of several sources; the potentials use
+// the first source as start
+std::vector<long> a_star_bidirectional(const std::vector<SearchSeed> &sources, int goal, SearchStats *stats)
+{
+    if (sources.empty())
+        return {};
+    const int start = sources[0].node;
+    const RoadGraph &g = road_graph;
+    const double INF = std::numeric_limits<double>::max();
+    const double speed = g.max_speed_mps;
+    auto potential = [&](int v)
+    {
+        if (speed <= 0)
+            return 0.0;
+        return (haversine(g.lat[v], g.lon[v], g.lat[goal], g.lon[goal]) -
+                haversine(g.lat[start], g.lon[start], g.lat[v], g.lon[v])) /
+               (2.0 * speed);
+    };
+
+    SearchWorkspace &forward = thread_workspace(0);
+    SearchWorkspace &backward = thread_workspace(1);
+    forward.reset(g.num_nodes());
+    backward.reset(g.num_nodes());
+
+    double mu = INF;
+    int meeting = -1;
+    long long settled = 0;
+
+    backward.set(goal, 0.0, -1);
+    backward.queue.push(goal, -potential(goal));
+    for (const SearchSeed &seed : sources)
+    {
+        if (seed.cost >= forward.distance(seed.node))
+            continue;
+        forward.set(seed.node, seed.cost, -1);
+        forward.queue.push(seed.node, seed.cost + potential(seed.node));
+        if (seed.node == goal && seed.cost < mu)
+        {
+            mu = seed.cost;
+            meeting = goal;
+        }
+    }
+
+    // Settle the smallest entry of one side; sign is +1 forward, -1 backward
+    auto expand = [&](SearchWorkspace &self, const SearchWorkspace &other, const std::vector<int> &offsets,
+                      const std::vector<int> &heads, const std::vector<double> &weights, double sign)
+    {
+        int u = self.queue.pop();
+        double d = self.distance(u);
+        settled++;
+
+        for (int e = offsets[u]; e < offsets[u + 1]; e++)
+        {
+            int v = heads[e];
+            double nd = d + weights[e];
+            if (nd >= self.distance(v))
+                continue;
+            self.set(v, nd, u);
+            self.queue.push(v, nd + sign * potential(v));
+
+            double other_d = other.distance(v);
+            if (other_d != INF && nd + other_d < mu)
+            {
+                mu = nd + other_d;
+                meeting = v;
             }
         }
+    };
+
+    while (!forward.queue.empty() && !backward.queue.empty())
+    {
+        double top_forward = forward.queue.top_key();
+        double top_backward = backward.queue.top_key();
+        if (top_forward + top_backward >= mu)
+            break;
+        if (top_forward <= top_backward)
+            expand(forward, backward, g.offsets, g.targets, g.weights, 1.0);
+        else
+            expand(backward, forward, g.in_offsets, g.in_sources, g.in_weights, -1.0);
     }
 
-    std::cout << "Simulated graph: " << nodes.size() << " nodes" << std::endl;
+    if (stats)
+    {
+        stats->settled += settled;
+        stats->distance = mu;
+    }
+    if (meeting == -1)
+        return {};
 
-    // compute components for simulated graph
-    compute_connected_components();
+    std::vector<long> path;
+    for (int v = meeting; v != -1; v = forward.parent_of(v))
+        path.push_back(g.osm_ids[v]);
+    std::reverse(path.begin(), path.end());
+    for (int v = backward.parent_of(meeting); v != -1; v = backward.parent_of(v))
+        path.push_back(g.osm_ids[v]);
+    return path;
 }
 
-// ==================== DIJKSTRA ALGORITHM ====================
+// ==================== ROAD GRAPH (CSR) ====================
 
-std::unordered_map<long, double> dijkstra(long start_node)
+// Builds the in-edge CSR and the speed bound of g from its out-edges
+void index_in_edges(RoadGraph &g)
 {
-    std::unordered_map<long, double> distances;
-    std::priority_queue<std::pair<double, long>,
-                        std::vector<std::pair<double, long>>,
-                        std::greater<std::pair<double, long>>>
-        pq;
+    const int n = g.num_nodes();
+    g.in_offsets.assign(n + 1, 0);
+    for (int v : g.targets)
+        g.in_offsets[v + 1]++;
+    for (int v = 0; v < n; v++)
+        g.in_offsets[v + 1] += g.in_offsets[v];
+
+    g.in_sources.resize(g.targets.size());
+    g.in_weights.resize(g.targets.size());
+    std::vector<int> fill(g.in_offsets.begin(), g.in_offsets.end() - 1);
+    g.max_speed_mps = 0.0;
+    bool bounded = true;
+    for (int u = 0; u < n; u++)
+    {
+        for (int e = g.offsets[u]; e < g.offsets[u + 1]; e++)
+        {
+            int v = g.targets[e];
+            int slot = fill[v]++;
+            g.in_sources[slot] = u;
+            g.in_weights[slot] = g.weights[e];
+
+            double meters = haversine(g.lat[u], g.lon[u], g.lat[v], g.lon[v]);
+            if (g.weights[e] > 0)
+                g.max_speed_mps = std::max(g.max_speed_mps, meters / g.weights[e]);
+            else if (meters > 0)
+                bounded = false;
+        }
+    }
+    if (!bounded)
+        g.max_speed_mps = 0.0;
+}
+
+// Freeze the staging graph/nodes maps into road_graph and release them.
+// Dense indices follow ascending OSM id so rebuilds are deterministic.
+void finalize_road_graph()
+{
+    road_graph.clear();
 
+    std::vector<long> ids;
+    ids.reserve(nodes.size());
     for (const auto &[node_id, _] : nodes)
+        ids.push_back(node_id);
+    std::sort(ids.begin(), ids.end());
+
+    const int n = (int)ids.size();
+    road_graph.osm_ids = ids;
+    road_graph.lat.resize(n);
+    road_graph.lon.resize(n);
+    road_graph.index_of.reserve(n);
+    for (int u = 0; u < n; u++)
     {
-        distances[node_id] = std::numeric_limits<double>::max();
+        const Node &node = nodes[ids[u]];
+        road_graph.lat[u] = node.lat;
+        road_graph.lon[u] = node.lon;
+        road_graph.index_of[ids[u]] = u;
     }
-    distances[start_node] = 0.0;
-
-    pq.push({0.0, start_node});
 
-    while (!pq.empty())
+    road_graph.offsets.assign(n + 1, 0);
+    for (int u = 0; u < n; u++)
     {
-        auto [current_dist, current_node] = pq.top();
-        pq.pop();
+        auto it = graph.find(ids[u]);
+        road_graph.offsets[u + 1] = road_graph.offsets[u] + (it == graph.end() ? 0 : (int)it->second.size());
+    }
 
-        if (current_dist > distances[current_node])
+    road_graph.targets.reserve(road_graph.offsets[n]);
+    road_graph.weights.reserve(road_graph.offsets[n]);
+    for (int u = 0; u < n; u++)
+    {
+        auto it = graph.find(ids[u]);
+        if (it == graph.end())
             continue;
+        for (const auto &[neighbor, weight] : it->second)
+        {
+            int v = road_graph.index(neighbor);
+            if (v == -1)
+                continue;
+            road_graph.targets.push_back(v);
+            road_graph.weights.push_back(weight);
+        }
+        road_graph.offsets[u + 1] = (int)road_graph.targets.size();
+    }
+
+    std::unordered_map<long, std::vector<std::pair<long, double>>>().swap(graph);
+    std::unordered_map<long, Node>().swap(nodes);
+
+    index_in_edges(road_graph);
+
+    std::cout << "CSR road graph: " << road_graph.num_nodes() << " nodes, "
+              << road_graph.num_edges() << " directed edges" << std::endl;
+
+    compute_connected_components();
+}
 
-        if (graph.find(current_node) != graph.end())
+// Collapses chains of shape-only vertices into single edges. A vertex is a
+// shape vertex when its only neighbours are two distinct vertices a and b and
+// it is either a two-way pass-through (a <-> v <-> b) or a one-way one
+// (a -> v -> b). Each chain becomes one edge per direction weighted by the
+// chain's total, keeping the collapsed coordinates as edge geometry so paths
+// can still be drawn along the road. Remaining vertices keep their relative
+// order; components are recomputed. Returns the number of vertices removed.
+int contract_degree2_chains()
+{
+    const RoadGraph &g = road_graph;
+    const int n = g.num_nodes();
+    if (n == 0 || g.has_geometry())
+        return 0;
+
+    // Sources of each vertex's in-edges
+    std::vector<int> in_offsets(n + 1, 0);
+    for (int t : g.targets)
+        in_offsets[t + 1]++;
+    for (int u = 0; u < n; u++)
+        in_offsets[u + 1] += in_offsets[u];
+    std::vector<int> in_sources(g.num_edges());
+    std::vector<int> fill(in_offsets.begin(), in_offsets.end() - 1);
+    for (int u = 0; u < n; u++)
+        for (int e = g.offsets[u]; e < g.offsets[u + 1]; e++)
+            in_sources[fill[g.targets[e]]++] = u;
+
+    std::vector<char> shape(n, 0);
+    for (int v = 0; v < n; v++)
+    {
+        const int *out = g.targets.data() + g.offsets[v];
+        const int *in = in_sources.data() + in_offsets[v];
+        int out_degree = g.degree(v);
+        int in_degree = in_offsets[v + 1] - in_offsets[v];
+        if (out_degree == 1 && in_degree == 1)
+            shape[v] = out[0] != in[0] && out[0] != v && in[0] != v;
+        else if (out_degree == 2 && in_degree == 2)
+            shape[v] = out[0] != out[1] && out[0] != v && out[1] != v &&
+                       ((in[0] == out[0] && in[1] == out[1]) || (in[0] == out[1] && in[1] == out[0]));
+    }
+
+    struct ChainEdge
+    {
+        int target;
+        double weight;
+        int shape_begin;
+        int shape_end;
+    };
+    std::vector<std::vector<ChainEdge>> chains(n);
+    std::vector<double> chain_lat, chain_lon;
+    std::vector<char> reached(n, 0);
+
+    // Follows every out-edge of a kept vertex through shape vertices to the
+    // next kept one (possibly u itself, for a loop)
+    auto walk_from = [&](int u)
+    {
+        for (int e = g.offsets[u]; e < g.offsets[u + 1]; e++)
         {
-            for (const auto &[neighbor, edge_weight] : graph[current_node])
+            ChainEdge edge{-1, g.weights[e], (int)chain_lat.size(), 0};
+            int prev = u;
+            int cur = g.targets[e];
+            while (shape[cur])
             {
-                double new_dist = current_dist + edge_weight;
+                reached[cur] = 1;
+                chain_lat.push_back(g.lat[cur]);
+                chain_lon.push_back(g.lon[cur]);
+                int next = g.offsets[cur];
+                if (g.degree(cur) == 2 && g.targets[next] == prev)
+                    next++;
+                edge.weight += g.weights[next];
+                prev = cur;
+                cur = g.targets[next];
+            }
+            edge.target = cur;
+            edge.shape_end = (int)chain_lat.size();
+            chains[u].push_back(edge);
+        }
+    };
+
+    for (int u = 0; u < n; u++)
+        if (!shape[u])
+            walk_from(u);
 
-                if (new_dist < distances[neighbor])
+    // A ring made only of shape vertices has no junction to collapse onto;
+    // it is kept as it is
+    std::vector<int> ring;
+    for (int v = 0; v < n; v++)
+    {
+        if (!shape[v] || reached[v])
+            continue;
+        ring.assign(1, v);
+        shape[v] = 0;
+        for (size_t i = 0; i < ring.size(); i++)
+        {
+            for (int e = g.offsets[ring[i]]; e < g.offsets[ring[i] + 1]; e++)
+            {
+                int t = g.targets[e];
+                if (shape[t] && !reached[t])
                 {
-                    distances[neighbor] = new_dist;
-                    pq.push({new_dist, neighbor});
+                    shape[t] = 0;
+                    ring.push_back(t);
                 }
             }
         }
+        for (int r : ring)
+            walk_from(r);
     }
 
-    return distances;
+    std::vector<int> new_index(n, -1);
+    RoadGraph contracted;
+    for (int u = 0; u < n; u++)
+    {
+        if (shape[u])
+            continue;
+        new_index[u] = (int)contracted.osm_ids.size();
+        contracted.osm_ids.push_back(g.osm_ids[u]);
+        contracted.lat.push_back(g.lat[u]);
+        contracted.lon.push_back(g.lon[u]);
+    }
+    const int m = contracted.num_nodes();
+    contracted.index_of.reserve(m);
+    for (int u = 0; u < m; u++)
+        contracted.index_of[contracted.osm_ids[u]] = u;
+
+    contracted.offsets.assign(1, 0);
+    for (int u = 0; u < n; u++)
+    {
+        if (shape[u])
+            continue;
+        for (const ChainEdge &edge : chains[u])
+        {
+            contracted.targets.push_back(new_index[edge.target]);
+            contracted.weights.push_back(edge.weight);
+            contracted.shape_offsets.push_back((int)contracted.shape_lat.size());
+            contracted.shape_lat.insert(contracted.shape_lat.end(), chain_lat.begin() + edge.shape_begin,
+                                        chain_lat.begin() + edge.shape_end);
+            contracted.shape_lon.insert(contracted.shape_lon.end(), chain_lon.begin() + edge.shape_begin,
+                                        chain_lon.begin() + edge.shape_end);
+        }
+        contracted.offsets.push_back(contracted.num_edges());
+    }
+    contracted.shape_offsets.push_back((int)contracted.shape_lat.size());
+
+    int removed = n - m;
+    std::cout << "🔗 Chain contraction: " << n << " -> " << m << " nodes, " << g.num_edges()
+              << " -> " << contracted.num_edges() << " directed edges ("
+              << std::fixed << std::setprecision(2) << (m > 0 ? (double)n / m : 0.0)
+              << "x smaller)" << std::defaultfloat << std::endl;
+
+    index_in_edges(contracted);
+    road_graph = std::move(contracted);
+    compute_connected_components();
+    return removed;
 }
 
-// ==================== PARALLEL DIJKSTRA FUNCTIONS ====================
+// Points indexed by the KD-tree: every connected vertex, plus the shape
+// points of contracted edges labelled with the edge end nearer along the
+// road, so snapping still sees the full road geometry. A two-way chain's
+// shape points are taken from one direction only.
+std::vector<KDPoint> road_snap_points()
+{
+    const RoadGraph &g = road_graph;
+    std::vector<KDPoint> points;
+    for (int u = 0; u < g.num_nodes(); u++)
+        if (g.degree(u) > 0)
+            points.push_back({g.lat[u], g.lon[u], g.osm_ids[u]});
 
-struct DijkstraResult
+    if (!g.has_geometry())
+        return points;
+
+    std::vector<double> along;
+    for (int u = 0; u < g.num_nodes(); u++)
+    {
+        for (int e = g.offsets[u]; e < g.offsets[u + 1]; e++)
+        {
+            int v = g.targets[e];
+            int begin = g.shape_offsets[e], end = g.shape_offsets[e + 1];
+            if (begin == end)
+                continue;
+            if (v < u)
+            {
+                bool twin = false;
+                for (int r = g.offsets[v]; r < g.offsets[v + 1] && !twin; r++)
+                    twin = g.targets[r] == u && g.shape_offsets[r + 1] - g.shape_offsets[r] == end - begin;
+                if (twin)
+                    continue;
+            }
+
+            // Cumulative length from u through each shape point to v
+            along.assign(1, 0.0);
+            double prev_lat = g.lat[u], prev_lon = g.lon[u];
+            for (int s = begin; s < end; s++)
+            {
+                along.push_back(along.back() + haversine(prev_lat, prev_lon, g.shape_lat[s], g.shape_lon[s]));
+                prev_lat = g.shape_lat[s];
+                prev_lon = g.shape_lon[s];
+            }
+            double total = along.back() + haversine(prev_lat, prev_lon, g.lat[v], g.lon[v]);
+            for (int s = begin; s < end; s++)
+            {
+                long owner = along[s - begin + 1] * 2 <= total ? g.osm_ids[u] : g.osm_ids[v];
+                points.push_back({g.shape_lat[s], g.shape_lon[s], owner});
+            }
+        }
+    }
+    return points;
+}
+
+// Segments indexed by segment_index: each piece of every edge's polyline
+// from its source through its shape points to its target. A two-way road is
+// indexed once, along its lower-numbered end's edge; snap_to_segment() finds
+// the reverse edge.
+std::vector<SegmentRTree::Segment> road_segments()
 {
-    std::string centre_id;
-    long start_node;
-    std::unordered_map<long, double> distances;
-    std::unordered_map<long, long> parents;
-    long long computation_time_ms;
-    bool success;
-    std::string error_message;
+    const RoadGraph &g = road_graph;
+    std::vector<SegmentRTree::Segment> segments;
+    segments.reserve(g.num_edges() / 2 + (g.has_geometry() ? g.shape_lat.size() : 0));
+    for (int u = 0; u < g.num_nodes(); u++)
+    {
+        for (int e = g.offsets[u]; e < g.offsets[u + 1]; e++)
+        {
+            int v = g.targets[e];
+            int begin = g.has_geometry() ? g.shape_offsets[e] : 0;
+            int end = g.has_geometry() ? g.shape_offsets[e + 1] : 0;
+            if (v < u)
+            {
+                bool twin = false;
+                for (int r = g.offsets[v]; r < g.offsets[v + 1] && !twin; r++)
+                    twin = g.targets[r] == u && (!g.has_geometry() || g.shape_offsets[r + 1] - g.shape_offsets[r] == end - begin);
+                if (twin)
+                    continue;
+            }
+
+            double prev_lat = g.lat[u], prev_lon = g.lon[u];
+            for (int s = begin; s <= end; s++)
+            {
+                double next_lat = s < end ? g.shape_lat[s] : g.lat[v];
+                double next_lon = s < end ? g.shape_lon[s] : g.lon[v];
+                segments.push_back({prev_lat, prev_lon, next_lat, next_lon, e, s - begin});
+                prev_lat = next_lat;
+                prev_lon = next_lon;
+            }
+        }
+    }
+    return segments;
+}
+
+// Coordinates along a path of vertex ids, including the shape points of each
+// edge taken (the cheapest one where two vertices are joined more than once)
+std::vector<std::pair<double, double>> path_geometry(const std::vector<long> &path)
+{
+    const RoadGraph &g = road_graph;
+    std::vector<std::pair<double, double>> coords;
+    int prev = -1;
+    for (long node_id : path)
+    {
+        int u = g.index(node_id);
+        if (u == -1)
+            continue;
+        if (prev != -1 && g.has_geometry())
+        {
+            int best = -1;
+            for (int e = g.offsets[prev]; e < g.offsets[prev + 1]; e++)
+                if (g.targets[e] == u && (best == -1 || g.weights[e] < g.weights[best]))
+                    best = e;
+            if (best != -1)
+                for (int s = g.shape_offsets[best]; s < g.shape_offsets[best + 1]; s++)
+                    coords.push_back({g.shape_lat[s], g.shape_lon[s]});
+        }
+        coords.push_back({g.lat[u], g.lon[u]});
+        prev = u;
+    }
+    return coords;
+}
+
+// ==================== NODE ORDERING ====================
+
+// Dense indices straight from OSM ids scatter neighbouring intersections
+// across memory. Renumbering vertices along a Hilbert curve keeps nearby
+// vertices (and hence most edges of a search frontier) close together in
+// every per-vertex array.
+
+// Position of (x, y) along a Hilbert curve filling a 2^16 x 2^16 grid
+uint64_t hilbert_index(uint32_t x, uint32_t y)
+{
+    const uint32_t n = 1u << 16;
+    uint64_t d = 0;
+    for (uint32_t s = n / 2; s > 0; s /= 2)
+    {
+        uint32_t rx = (x & s) > 0;
+        uint32_t ry = (y & s) > 0;
+        d += (uint64_t)s * s * ((3 * rx) ^ ry);
+        if (ry == 0)
+        {
+            if (rx == 1)
+            {
+                x = n - 1 - x;
+                y = n - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return d;
+}
+
+// Vertices sorted by Hilbert position over the graph's bounding box (ties
+// by OSM id); order[i] is the current index of the vertex that becomes i
+std::vector<int> hilbert_order(const RoadGraph &g)
+{
+    const int n = g.num_nodes();
+    std::vector<int> order(n);
+    for (int u = 0; u < n; u++)
+        order[u] = u;
+    if (n == 0)
+        return order;
+
+    auto [min_lat, max_lat] = std::minmax_element(g.lat.begin(), g.lat.end());
+    auto [min_lon, max_lon] = std::minmax_element(g.lon.begin(), g.lon.end());
+    double lat_span = std::max(*max_lat - *min_lat, 1e-9);
+    double lon_span = std::max(*max_lon - *min_lon, 1e-9);
+
+    std::vector<uint64_t> keys(n);
+    for (int u = 0; u < n; u++)
+    {
+        uint32_t x = (uint32_t)((g.lon[u] - *min_lon) / lon_span * 65535.0);
+        uint32_t y = (uint32_t)((g.lat[u] - *min_lat) / lat_span * 65535.0);
+        keys[u] = hilbert_index(x, y);
+    }
+    std::sort(order.begin(), order.end(), [&](int a, int b)
+              { return keys[a] != keys[b] ? keys[a] < keys[b] : g.osm_ids[a] < g.osm_ids[b]; });
+    return order;
+}
+
+// Vertices sorted by OSM id: the layout finalize_road_graph() produces
+std::vector<int> osm_id_order(const RoadGraph &g)
+{
+    std::vector<int> order(g.num_nodes());
+    for (int u = 0; u < g.num_nodes(); u++)
+        order[u] = u;
+    std::sort(order.begin(), order.end(), [&](int a, int b)
+              { return g.osm_ids[a] < g.osm_ids[b]; });
+    return order;
+}
+
+// Copy of g with vertex order[i] renumbered to i. Out-edges (and their
+// geometry) keep their relative order.
+RoadGraph permuted_road_graph(const RoadGraph &g, const std::vector<int> &order)
+{
+    const int n = g.num_nodes();
+    std::vector<int> new_index(n);
+    for (int i = 0; i < n; i++)
+        new_index[order[i]] = i;
+
+    RoadGraph out;
+    out.osm_ids.resize(n);
+    out.lat.resize(n);
+    out.lon.resize(n);
+    out.index_of.reserve(n);
+    out.offsets.assign(1, 0);
+    out.targets.reserve(g.num_edges());
+    out.weights.reserve(g.num_edges());
+    if (g.has_geometry())
+    {
+        out.shape_offsets.assign(1, 0);
+        out.shape_lat.reserve(g.shape_lat.size());
+        out.shape_lon.reserve(g.shape_lon.size());
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        int u = order[i];
+        out.osm_ids[i] = g.osm_ids[u];
+        out.lat[i] = g.lat[u];
+        out.lon[i] = g.lon[u];
+        out.index_of[g.osm_ids[u]] = i;
+        for (int e = g.offsets[u]; e < g.offsets[u + 1]; e++)
+        {
+            out.targets.push_back(new_index[g.targets[e]]);
+            out.weights.push_back(g.weights[e]);
+            if (g.has_geometry())
+            {
+                out.shape_lat.insert(out.shape_lat.end(), g.shape_lat.begin() + g.shape_offsets[e],
+                                     g.shape_lat.begin() + g.shape_offsets[e + 1]);
+                out.shape_lon.insert(out.shape_lon.end(), g.shape_lon.begin() + g.shape_offsets[e],
+                                     g.shape_lon.begin() + g.shape_offsets[e + 1]);
+                out.shape_offsets.push_back((int)out.shape_lat.size());
+            }
+        }
+        out.offsets.push_back(out.num_edges());
+    }
+    index_in_edges(out);
+    return out;
+}
+
+// Renumbers road_graph along the Hilbert curve and recomputes components.
+// Must run before the KD-tree, hierarchy and centre buckets are built, since
+// those are derived from the dense indices.
+void reorder_road_graph()
+{
+    if (road_graph.num_nodes() == 0)
+        return;
+    road_graph = permuted_road_graph(road_graph, hilbert_order(road_graph));
+    std::cout << "🧭 Renumbered " << road_graph.num_nodes() << " nodes along a Hilbert curve" << std::endl;
+    compute_connected_components();
+}
+
+// ==================== OVERPASS API INTEGRATION ====================
+
+// Byte stream written by the curl transfer and read by the JSON parser on
+// another thread, so a response is parsed while it is still arriving.
+// Chunks pushed after the reader has stopped are dropped. At most
+// MAX_QUEUED_BYTES wait in the queue: past that, push() blocks the transfer
+// until the parser catches up, so a slow parser never buffers the response.
+class ChunkStreamBuf : public std::streambuf
+{
+public:
+    void push(const char *data, size_t size)
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        bytes += size;
+        drained.wait(guard, [&]()
+                     { return queued_bytes < MAX_QUEUED_BYTES || reader_done; });
+        if (reader_done || size == 0)
+            return;
+        chunks.emplace_back(data, size);
+        queued_bytes += size;
+        ready.notify_one();
+    }
+
+    // End of input: the reader sees EOF once the queued chunks are consumed
+    void close()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        finished = true;
+        ready.notify_one();
+    }
+
+    void stop_reading()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        reader_done = true;
+        chunks.clear();
+        queued_bytes = 0;
+        drained.notify_all();
+    }
+
+    size_t bytes_received()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return bytes;
+    }
+
+protected:
+    int_type underflow() override
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        ready.wait(guard, [&]()
+                   { return !chunks.empty() || finished; });
+        if (chunks.empty())
+            return traits_type::eof();
+        current = std::move(chunks.front());
+        chunks.pop_front();
+        queued_bytes -= current.size();
+        drained.notify_all();
+        setg(&current[0], &current[0], &current[0] + current.size());
+        return traits_type::to_int_type(*gptr());
+    }
+
+private:
+    static constexpr size_t MAX_QUEUED_BYTES = 8 << 20;
+
+    std::mutex lock;
+    std::condition_variable ready;   // signalled when a chunk arrives or input ends
+    std::condition_variable drained; // signalled when the queue shrinks or the reader stops
+    std::deque<std::string> chunks;
+    std::string current;
+    size_t queued_bytes = 0; // in chunks, not counting current
+    size_t bytes = 0;
+    bool finished = false;
+    bool reader_done = false;
+};
+
+// Where the curl write callback sends the response bytes
+struct FetchSink
+{
+    ChunkStreamBuf *stream;
+    std::ofstream *cache_file; // raw copy for the response cache, or nullptr
 };
 
-// Modified Dijkstra that also tracks parents for path reconstruction
-std::pair<std::unordered_map<long, double>, std::unordered_map<long, long>>
-dijkstra_with_parents(long start_node)
+static size_t stream_write_callback(void *contents, size_t size, size_t nmemb, void *userp)
+{
+    FetchSink *sink = (FetchSink *)userp;
+    sink->stream->push((const char *)contents, size * nmemb);
+    if (sink->cache_file)
+        sink->cache_file->write((const char *)contents, size * nmemb);
+    return size * nmemb;
+}
+
+// Highway values loaded for a graph_detail level, as a regex alternation
+std::string highway_types_for_detail(const std::string &graph_detail)
+{
+    if (graph_detail == "low")
+    {
+        std::cout << "📉 Low detail: Major roads only (fastest)" << std::endl;
+        return "primary|secondary|tertiary";
+    }
+    if (graph_detail == "high")
+    {
+        std::cout << "📈 High detail: All roads (most accurate)" << std::endl;
+        return "motorway|trunk|primary|secondary|tertiary|residential|living_street|service|unclassified";
+    }
+    std::cout << "📊 Medium detail: Most roads (balanced)" << std::endl;
+    return "primary|secondary|tertiary|residential|living_street|service|unclassified";
+}
+
+// Overpass evaluates highway~"a|b" as an unanchored regex, so a value
+// matches if it contains any alternative (primary_link matches primary).
+// Local OSM files are filtered the same way.
+bool highway_matches(const std::string &highway, const std::string &highway_types)
+{
+    size_t start = 0;
+    while (start <= highway_types.size())
+    {
+        size_t end = highway_types.find('|', start);
+        if (end == std::string::npos)
+            end = highway_types.size();
+        if (end > start && highway.find(highway_types.substr(start, end - start)) != std::string::npos)
+            return true;
+        start = end + 1;
+    }
+    return false;
+}
+
+const std::string OVERPASS_DEFAULT_URL = "https://overpass-api.de/api/interpreter";
+// Interpreter endpoint used by /build-graph. A server-side setting (the
+// OVERPASS_URL environment variable), never taken from a request.
+std::string overpass_server_url = OVERPASS_DEFAULT_URL;
+// A single query much larger than this tends to hit the 60 s server timeout
+const double OVERPASS_TILE_DEG = 0.25;
+// The public Overpass instance grants about two concurrent slots per client
+const int OVERPASS_MAX_PARALLEL = 2;
+
+std::string overpass_query(double min_lat, double min_lon, double max_lat, double max_lon, const std::string &highway_types)
+{
+    std::stringstream query_stream;
+    query_stream << std::fixed << std::setprecision(8);
+    query_stream << "[out:json][timeout:60];";
+    query_stream << "(";
+    query_stream << "way[highway~\"" << highway_types << "\"]";
+    query_stream << "(" << min_lat << "," << min_lon << "," << max_lat << "," << max_lon << ");";
+    query_stream << "node(w);";
+    query_stream << ");";
+    query_stream << "out body;";
+    return query_stream.str();
+}
+
+double get_default_speed(const std::string &highway_type)
+{
+    if (highway_type == "motorway")
+        return 100.0;
+    if (highway_type == "trunk")
+        return 90.0;
+    if (highway_type == "primary")
+        return 80.0;
+    if (highway_type == "secondary")
+        return 60.0;
+    if (highway_type == "tertiary")
+        return 50.0;
+    if (highway_type == "residential")
+        return 30.0;
+    if (highway_type == "living_street")
+        return 20.0;
+    if (highway_type == "service")
+        return 20.0;
+    if (highway_type == "unclassified")
+        return 40.0;
+    return 30.0;
+}
+
+// Routing attributes of a highway way, from its OSM tags
+struct WayInfo
+{
+    std::string highway;
+    bool oneway = false;
+    double speed_kmh = 30.0;
+};
+
+// Tag values are empty when the tag is absent
+WayInfo make_way_info(const std::string &highway, const std::string &oneway, const std::string &maxspeed)
+{
+    WayInfo info;
+    if (!highway.empty())
+    {
+        info.highway = highway;
+        info.speed_kmh = get_default_speed(highway);
+    }
+
+    info.oneway = (oneway == "yes" || oneway == "true" || oneway == "1");
+
+    if (!maxspeed.empty())
+    {
+        try
+        {
+            info.speed_kmh = std::stod(maxspeed);
+        }
+        catch (...)
+        {
+        }
+    }
+    return info;
+}
+
+// Add the edges of one way to the staging graph; segments with an endpoint
+// missing from `nodes` are skipped
+void add_way_edges(const std::vector<long> &way_node_ids, const WayInfo &info,
+                   int &edge_count, int &oneway_count)
+{
+    for (size_t i = 0; i + 1 < way_node_ids.size(); i++)
+    {
+        long node1_id = way_node_ids[i];
+        long node2_id = way_node_ids[i + 1];
+
+        auto it1 = nodes.find(node1_id);
+        auto it2 = nodes.find(node2_id);
+        if (it1 == nodes.end() || it2 == nodes.end())
+            continue;
+
+        double dist_meters = haversine(it1->second.lat, it1->second.lon,
+                                       it2->second.lat, it2->second.lon);
+
+        double dist_km = dist_meters / 1000.0;
+        double time_hours = dist_km / info.speed_kmh;
+        double time_seconds = time_hours * 3600.0;
+        double edge_weight = time_seconds;
+
+        if (info.oneway)
+        {
+            graph[node1_id].push_back({node2_id, edge_weight});
+            edge_count++;
+            oneway_count++;
+        }
+        else
+        {
+            graph[node1_id].push_back({node2_id, edge_weight});
+            graph[node2_id].push_back({node1_id, edge_weight});
+            edge_count += 2;
+        }
+    }
+}
+
+// Highway ways of one extract as flat node-id runs. Ways are buffered until
+// every node coordinate is known, since a source may list a way before the
+// nodes it references.
+struct WayBuffer
+{
+    std::vector<long> ids;
+    std::vector<WayInfo> infos;
+    std::vector<size_t> starts{0};
+    std::vector<long> node_ids;
+
+    size_t size() const { return infos.size(); }
+
+    void add(long id, const WayInfo &info, const std::vector<long> &refs)
+    {
+        ids.push_back(id);
+        infos.push_back(info);
+        node_ids.insert(node_ids.end(), refs.begin(), refs.end());
+        starts.push_back(node_ids.size());
+    }
+};
+
+// Add the edges of every buffered way, in order, then release the buffer
+void add_buffered_way_edges(WayBuffer &ways, int &edge_count, int &oneway_count)
+{
+    std::vector<long> refs;
+    for (size_t w = 0; w < ways.size(); w++)
+    {
+        refs.assign(ways.node_ids.begin() + ways.starts[w], ways.node_ids.begin() + ways.starts[w + 1]);
+        add_way_edges(refs, ways.infos[w], edge_count, oneway_count);
+    }
+    ways = WayBuffer();
+}
+
+// Nodes and ways read from one Overpass response
+struct OverpassExtract
+{
+    std::unordered_map<long, Node> nodes;
+    WayBuffer ways;
+    size_t bytes = 0;
+};
+
+// SAX handler for an Overpass JSON response ({"elements": [...]}). Nodes and
+// ways go straight into an OverpassExtract in a single pass, so the response
+// is never materialised as a DOM. Depths: 1 = root object, 2 = elements
+// array, 3 = one element, 4 = its "tags" object or "nodes" array. Anything
+// else (bounds, geometry, members, ...) is skipped.
+class OverpassSaxHandler : public nlohmann::json_sax<json>
+{
+public:
+    explicit OverpassSaxHandler(OverpassExtract &extract) : extract(extract) {}
+
+    std::string remark; // Overpass reports server-side errors (e.g. timeouts) here
+    std::string error;
+
+    bool null() override { return true; }
+    bool boolean(bool) override { return true; }
+    bool binary(binary_t &) override { return true; }
+
+    bool number_integer(number_integer_t val) override
+    {
+        return number(static_cast<long>(val), static_cast<double>(val));
+    }
+
+    bool number_unsigned(number_unsigned_t val) override
+    {
+        return number(static_cast<long>(val), static_cast<double>(val));
+    }
+
+    bool number_float(number_float_t val, const string_t &) override
+    {
+        return number(static_cast<long>(val), val);
+    }
+
+    bool string(string_t &val) override
+    {
+        if (in_element && depth == 3 && element_key == "type")
+            type = val;
+        else if (in_tags && depth == 4)
+        {
+            if (tag_key == "highway")
+                highway = val;
+            else if (tag_key == "oneway")
+                oneway = val;
+            else if (tag_key == "maxspeed")
+                maxspeed = val;
+        }
+        else if (depth == 1 && root_key == "remark")
+            remark = val;
+        return true;
+    }
+
+    bool start_object(std::size_t) override
+    {
+        depth++;
+        if (depth == 3 && in_elements)
+            begin_element();
+        else if (depth == 4 && in_element && element_key == "tags")
+            in_tags = true;
+        return true;
+    }
+
+    bool key(string_t &val) override
+    {
+        if (depth == 1)
+            root_key = val;
+        else if (depth == 3 && in_element)
+            element_key = val;
+        else if (depth == 4 && in_tags)
+            tag_key = val;
+        return true;
+    }
+
+    bool end_object() override
+    {
+        if (depth == 3 && in_element)
+            end_element();
+        else if (depth == 4)
+            in_tags = false;
+        depth--;
+        return true;
+    }
+
+    bool start_array(std::size_t) override
+    {
+        depth++;
+        if (depth == 2 && root_key == "elements")
+            in_elements = true;
+        else if (depth == 4 && in_element && element_key == "nodes")
+            in_refs = true;
+        return true;
+    }
+
+    bool end_array() override
+    {
+        if (depth == 2)
+            in_elements = false;
+        else if (depth == 4)
+            in_refs = false;
+        depth--;
+        return true;
+    }
+
+    bool parse_error(std::size_t, const std::string &, const nlohmann::detail::exception &ex) override
+    {
+        error = ex.what();
+        return false;
+    }
+
+private:
+    OverpassExtract &extract;
+    int depth = 0;
+    bool in_elements = false;
+    bool in_element = false;
+    bool in_tags = false;
+    bool in_refs = false;
+    std::string root_key, element_key, tag_key;
+
+    // Current element
+    std::string type, highway, oneway, maxspeed;
+    long id = 0;
+    double lat = std::numeric_limits<double>::quiet_NaN();
+    double lon = std::numeric_limits<double>::quiet_NaN();
+    std::vector<long> refs;
+
+    bool number(long as_integer, double as_double)
+    {
+        if (in_refs && depth == 4)
+            refs.push_back(as_integer);
+        else if (in_element && depth == 3)
+        {
+            if (element_key == "id")
+                id = as_integer;
+            else if (element_key == "lat")
+                lat = as_double;
+            else if (element_key == "lon")
+                lon = as_double;
+        }
+        return true;
+    }
+
+    void begin_element()
+    {
+        in_element = true;
+        element_key.clear();
+        type.clear();
+        highway.clear();
+        oneway.clear();
+        maxspeed.clear();
+        id = 0;
+        lat = lon = std::numeric_limits<double>::quiet_NaN();
+        refs.clear();
+    }
+
+    void end_element()
+    {
+        in_element = false;
+        if (type == "node" && !std::isnan(lat) && !std::isnan(lon))
+            extract.nodes[id] = {id, lat, lon};
+        else if (type == "way" && !refs.empty())
+            extract.ways.add(id, make_way_info(highway, oneway, maxspeed), refs);
+    }
+};
+
+// --- Response cache ---
+
+// On-disk cache of raw Overpass responses. Each file is named by a hash of
+// the normalised query (bbox + detail level), so repeated requests for a
+// region share it. Hits refresh the file's mtime and the least recently used
+// files are evicted once the directory grows past max_bytes. A recorded
+// response dropped in under the right name serves as an offline stand-in.
+struct OverpassCacheConfig
+{
+    bool enabled = true;
+    bool offline = false; // serve from the cache only, never the network
+    std::string dir = "overpass_cache";
+    uintmax_t max_bytes = 512ull * 1024 * 1024;
+};
+
+// Cache directory used by /build-graph. A server-side setting (the
+// OVERPASS_CACHE_DIR environment variable), never taken from a request,
+// since eviction deletes files in it.
+std::string overpass_server_cache_dir = "overpass_cache";
+
+// Bboxes are widened to a 1e-4 degree (~11 m) grid before querying, so
+// nearly identical requests map to the same query and cache entry
+void normalise_bbox(double &min_lat, double &min_lon, double &max_lat, double &max_lon)
+{
+    const double GRID = 1e4;
+    min_lat = std::floor(min_lat * GRID) / GRID;
+    min_lon = std::floor(min_lon * GRID) / GRID;
+    max_lat = std::ceil(max_lat * GRID) / GRID;
+    max_lon = std::ceil(max_lon * GRID) / GRID;
+}
+
+std::string overpass_cache_path(const OverpassCacheConfig &cache, const std::string &query)
+{
+    uint64_t hash = 14695981039346656037ull; // FNV-1a
+    for (unsigned char c : query)
+    {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.json", static_cast<unsigned long long>(hash));
+    return (std::filesystem::path(cache.dir) / name).string();
+}
+
+// Parses a cached response into `extract`. Unreadable or corrupt entries are
+// deleted so the next request refetches them.
+bool read_cached_overpass(const std::string &path, OverpassExtract &extract)
+{
+    std::error_code ec;
+    if (!std::filesystem::exists(path, ec))
+        return false;
+
+    std::ifstream in(path, std::ios::binary);
+    OverpassSaxHandler handler(extract);
+    if (!in || !json::sax_parse(in, &handler))
+    {
+        std::cerr << "⚠️  Dropping corrupt Overpass cache entry " << path << std::endl;
+        in.close();
+        std::filesystem::remove(path, ec);
+        extract = OverpassExtract();
+        return false;
+    }
+
+    extract.bytes = std::filesystem::file_size(path, ec);
+    std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), ec);
+    return true;
+}
+
+// True for names overpass_cache_path() creates: 16 hex digits + ".json"
+bool is_overpass_cache_name(const std::string &name)
+{
+    if (name.size() != 21 || name.compare(16, 5, ".json") != 0)
+        return false;
+    for (int i = 0; i < 16; i++)
+        if (!std::isxdigit((unsigned char)name[i]))
+            return false;
+    return true;
+}
+
+// Deletes least recently used entries until the cache fits in max_bytes.
+// Only the cache's own files are counted or deleted.
+void evict_overpass_cache(const OverpassCacheConfig &cache)
+{
+    std::error_code ec;
+    std::vector<std::pair<std::filesystem::file_time_type, std::filesystem::path>> entries;
+    uintmax_t total = 0;
+    for (const auto &entry : std::filesystem::directory_iterator(cache.dir, ec))
+    {
+        if (!entry.is_regular_file(ec) || !is_overpass_cache_name(entry.path().filename().string()))
+            continue;
+        total += entry.file_size(ec);
+        entries.push_back({entry.last_write_time(ec), entry.path()});
+    }
+    if (total <= cache.max_bytes)
+        return;
+
+    std::sort(entries.begin(), entries.end());
+    for (const auto &[mtime, path] : entries)
+    {
+        if (total <= cache.max_bytes)
+            break;
+        uintmax_t size = std::filesystem::file_size(path, ec);
+        if (std::filesystem::remove(path, ec))
+        {
+            total -= size;
+            std::cout << "🗑️  Evicted Overpass cache entry " << path.filename().string() << std::endl;
+        }
+    }
+}
+
+// --- Download ---
+
+// One Overpass query: its curl handle, the stream feeding its SAX parser
+// thread and the cache file receiving a raw copy of the response
+struct OverpassTransfer
+{
+    std::string query;
+    std::string cache_path;
+    OverpassExtract extract;
+    ChunkStreamBuf stream;
+    std::ofstream cache_file;
+    FetchSink sink{&stream, nullptr};
+    OverpassSaxHandler handler{extract};
+    std::thread parser;
+    bool parsed = false;
+    CURL *curl = nullptr;
+    CURLcode result = CURLE_OK;
+    long http_code = 0;
+    bool done = false; // extract complete (downloaded or read from the cache)
+};
+
+// Creates the easy handle and starts the parser thread; the caller runs the
+// handle (alone or in a multi handle) and then calls finish_overpass_transfer
+bool start_overpass_transfer(OverpassTransfer &t, const std::string &overpass_url, const OverpassCacheConfig &cache)
+{
+    t.curl = curl_easy_init();
+    if (!t.curl)
+    {
+        std::cerr << "Failed to initialize curl" << std::endl;
+        return false;
+    }
+
+    char *encoded_query = curl_easy_escape(t.curl, t.query.c_str(), t.query.length());
+    std::string url = overpass_url + "?data=" + std::string(encoded_query);
+    curl_free(encoded_query);
+
+    if (cache.enabled)
+    {
+        std::error_code ec;
+        std::filesystem::create_directories(cache.dir, ec);
+        t.cache_file.open(t.cache_path + ".tmp", std::ios::binary | std::ios::trunc);
+        if (t.cache_file.is_open())
+            t.sink.cache_file = &t.cache_file;
+    }
+
+    t.parser = std::thread([&t]()
+                           {
+        std::istream in(&t.stream);
+        t.parsed = json::sax_parse(in, &t.handler);
+        t.stream.stop_reading(); });
+
+    curl_easy_setopt(t.curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(t.curl, CURLOPT_WRITEFUNCTION, stream_write_callback);
+    curl_easy_setopt(t.curl, CURLOPT_WRITEDATA, &t.sink);
+    curl_easy_setopt(t.curl, CURLOPT_PRIVATE, &t);
+    curl_easy_setopt(t.curl, CURLOPT_TIMEOUT, 60L);
+    curl_easy_setopt(t.curl, CURLOPT_FOLLOWLOCATION, 1L);
+    // HTTP(S) only, redirects included
+#if LIBCURL_VERSION_NUM >= 0x075500
+    curl_easy_setopt(t.curl, CURLOPT_PROTOCOLS_STR, "http,https");
+    curl_easy_setopt(t.curl, CURLOPT_REDIR_PROTOCOLS_STR, "http,https");
+#else
+    curl_easy_setopt(t.curl, CURLOPT_PROTOCOLS, (long)(CURLPROTO_HTTP | CURLPROTO_HTTPS));
+    curl_easy_setopt(t.curl, CURLOPT_REDIR_PROTOCOLS, (long)(CURLPROTO_HTTP | CURLPROTO_HTTPS));
+#endif
+    return true;
+}
+
+// Ends the parse once curl has finished with the handle (t.result set),
+// keeps the raw copy if the response is complete, and reports whether the
+// extract is usable. A 200 response with malformed JSON sets `error`.
+bool finish_overpass_transfer(OverpassTransfer &t, const OverpassCacheConfig &cache, std::string &error)
+{
+    t.stream.close();
+    t.parser.join();
+    curl_easy_getinfo(t.curl, CURLINFO_RESPONSE_CODE, &t.http_code);
+    curl_easy_cleanup(t.curl);
+    t.curl = nullptr;
+    t.extract.bytes = t.stream.bytes_received();
+
+    bool ok = t.result == CURLE_OK && t.http_code == 200;
+
+    // Only complete, well-formed responses without a server remark (which
+    // flags a truncated result) are kept
+    if (t.cache_file.is_open())
+    {
+        t.cache_file.close();
+        std::error_code ec;
+        if (ok && t.parsed && t.handler.remark.empty() && t.cache_file)
+        {
+            std::filesystem::rename(t.cache_path + ".tmp", t.cache_path, ec);
+            evict_overpass_cache(cache);
+        }
+        else
+            std::filesystem::remove(t.cache_path + ".tmp", ec);
+    }
+
+    if (!ok)
+    {
+        if (t.result != CURLE_OK)
+            std::cerr << "curl transfer failed: " << curl_easy_strerror(t.result) << std::endl;
+        else
+            std::cerr << "HTTP error: " << t.http_code << std::endl;
+        t.extract = OverpassExtract();
+        return false;
+    }
+    if (!t.parsed)
+    {
+        error = "Invalid Overpass response: " + t.handler.error;
+        t.extract = OverpassExtract();
+        return false;
+    }
+    if (!t.handler.remark.empty())
+    {
+        // Typically a server-side timeout: the result is incomplete
+        std::cerr << "⚠️  Overpass remark: " << t.handler.remark << std::endl;
+        t.extract = OverpassExtract();
+        return false;
+    }
+    return true;
+}
+
+// Counters reported by /build-graph for an Overpass fetch
+struct OverpassFetchStats
+{
+    int tiles = 0;
+    int cache_hits = 0;
+    int retries = 0;
+    size_t bytes = 0;
+    size_t duplicate_ways = 0;
+    int edge_count = 0;
+    int oneway_count = 0;
+};
+
+// Adds one tile to the staging graph. Ways crossing a tile edge come back
+// whole (with all their nodes) from every tile they touch, so each way id is
+// only added once; shared nodes are identical and kept once.
+void stitch_overpass_tile(OverpassExtract &extract, std::unordered_set<long> &seen_ways, OverpassFetchStats &stats)
+{
+    if (nodes.empty())
+        nodes = std::move(extract.nodes);
+    else
+        for (const auto &entry : extract.nodes)
+            nodes.try_emplace(entry.first, entry.second);
+
+    const WayBuffer &ways = extract.ways;
+    std::vector<long> refs;
+    for (size_t w = 0; w < ways.size(); w++)
+    {
+        if (!seen_ways.insert(ways.ids[w]).second)
+        {
+            stats.duplicate_ways++;
+            continue;
+        }
+        refs.assign(ways.node_ids.begin() + ways.starts[w], ways.node_ids.begin() + ways.starts[w + 1]);
+        add_way_edges(refs, ways.infos[w], stats.edge_count, stats.oneway_count);
+    }
+    stats.bytes += extract.bytes;
+    extract = OverpassExtract();
+}
+
+// Fetches the bbox from Overpass into the staging graph (`nodes`/`graph`).
+// Boxes larger than tile_deg on a side are split into a grid of tiles that
+// are queried concurrently (at most max_parallel transfers) through a curl
+// multi handle, each parsed by its own SAX thread as it downloads. Finished
+// tiles are stitched in tile order while later ones are still in flight, so
+// the result does not depend on completion order. Cached tiles skip the
+// network. A failed tile, or one whose result the server flagged as
+// truncated with a remark, is retried once. If a download fails again the
+// fetch returns false and the caller falls back to a simulated graph. Throws
+// if the server answered with malformed JSON or truncated the same tile
+// twice.
+bool fetch_overpass_graph(double min_lat, double min_lon, double max_lat, double max_lon,
+                          const std::string &graph_detail, const std::string &overpass_url,
+                          const OverpassCacheConfig &cache, double tile_deg, int max_parallel,
+                          OverpassFetchStats &stats)
+{
+    std::cout << "Fetching real road data from Overpass API (detail: " << graph_detail << ")..." << std::endl;
+
+    nodes.clear();
+    graph.clear();
+    road_graph.clear();
+    node_component.clear();
+
+    normalise_bbox(min_lat, min_lon, max_lat, max_lon);
+    int rows = 1, cols = 1;
+    if (tile_deg > 0)
+    {
+        rows = std::max(1, (int)std::ceil((max_lat - min_lat) / tile_deg - 1e-9));
+        cols = std::max(1, (int)std::ceil((max_lon - min_lon) / tile_deg - 1e-9));
+    }
+    max_parallel = std::max(1, max_parallel);
+    stats.tiles = rows * cols;
+
+    std::string highway_types = highway_types_for_detail(graph_detail);
+    std::vector<std::unique_ptr<OverpassTransfer>> tiles(stats.tiles);
+    for (int r = 0; r < rows; r++)
+    {
+        for (int c = 0; c < cols; c++)
+        {
+            double t_min_lat = min_lat + (max_lat - min_lat) * r / rows;
+            double t_max_lat = min_lat + (max_lat - min_lat) * (r + 1) / rows;
+            double t_min_lon = min_lon + (max_lon - min_lon) * c / cols;
+            double t_max_lon = min_lon + (max_lon - min_lon) * (c + 1) / cols;
+            normalise_bbox(t_min_lat, t_min_lon, t_max_lat, t_max_lon);
+
+            auto &t = tiles[r * cols + c];
+            t = std::make_unique<OverpassTransfer>();
+            t->query = overpass_query(t_min_lat, t_min_lon, t_max_lat, t_max_lon, highway_types);
+            if (cache.enabled || cache.offline)
+                t->cache_path = overpass_cache_path(cache, t->query);
+        }
+    }
+    if (stats.tiles == 1)
+        std::cout << "Query: " << tiles[0]->query << std::endl;
+    else
+        std::cout << "🧩 Split into " << rows << "x" << cols << " tiles of " << tile_deg
+                  << "° (" << max_parallel << " concurrent transfers)" << std::endl;
+
+    std::unordered_set<long> seen_ways;
+    size_t next_stitch = 0;
+    auto stitch_ready = [&]()
+    {
+        while (next_stitch < tiles.size() && tiles[next_stitch]->done)
+            stitch_overpass_tile(tiles[next_stitch++]->extract, seen_ways, stats);
+    };
+
+    std::vector<size_t> pending;
+    for (size_t i = 0; i < tiles.size(); i++)
+    {
+        OverpassTransfer &t = *tiles[i];
+        if (!t.cache_path.empty() && read_cached_overpass(t.cache_path, t.extract))
+        {
+            t.done = true;
+            stats.cache_hits++;
+            std::cout << "💾 Overpass cache hit: " << t.cache_path << " (" << t.extract.nodes.size()
+                      << " nodes, " << t.extract.ways.size() << " ways)" << std::endl;
+        }
+        else
+        {
+            if (!t.cache_path.empty())
+                std::cout << "💾 Overpass cache miss: " << t.cache_path << std::endl;
+            pending.push_back(i);
+        }
+    }
+    stitch_ready();
+    if (cache.offline && !pending.empty())
+    {
+        std::cerr << "Offline mode: " << pending.size() << " tile(s) have no cached response" << std::endl;
+        return false;
+    }
+
+    CURLM *multi = curl_multi_init();
+    if (!multi)
+    {
+        std::cerr << "Failed to initialize curl" << std::endl;
+        return false;
+    }
+
+    std::vector<int> attempts(tiles.size(), 0);
+    std::string error;
+    bool failed = false;
+    size_t next_pending = 0;
+    int active = 0;
+
+    while (true)
+    {
+        while (!failed && active < max_parallel && next_pending < pending.size())
+        {
+            size_t i = pending[next_pending++];
+            attempts[i]++;
+            if (!start_overpass_transfer(*tiles[i], overpass_url, cache))
+            {
+                failed = true;
+                break;
+            }
+            curl_multi_add_handle(multi, tiles[i]->curl);
+            active++;
+        }
+        if (active == 0)
+            break;
+
+        int running = 0;
+        curl_multi_perform(multi, &running);
+
+        int queued = 0;
+        while (CURLMsg *msg = curl_multi_info_read(multi, &queued))
+        {
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+            OverpassTransfer *t = nullptr;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&t);
+            t->result = msg->data.result;
+            curl_multi_remove_handle(multi, msg->easy_handle);
+            active--;
+
+            size_t i = 0;
+            while (tiles[i].get() != t)
+                i++;
+
+            if (finish_overpass_transfer(*t, cache, error))
+            {
+                t->done = true;
+                stitch_ready();
+            }
+            else if (error.empty() && attempts[i] < 2)
+            {
+                if (!t->handler.remark.empty())
+                    std::cerr << "Tile " << i + 1 << "/" << tiles.size() << " was truncated" << std::endl;
+                std::cerr << "Retrying tile " << i + 1 << "/" << tiles.size() << std::endl;
+                std::string query = t->query, cache_path = t->cache_path;
+                tiles[i] = std::make_unique<OverpassTransfer>();
+                tiles[i]->query = query;
+                tiles[i]->cache_path = cache_path;
+                pending.push_back(i);
+                stats.retries++;
+            }
+            else
+            {
+                // A second truncated result fails the build rather than
+                // leaving a hole in the graph
+                if (error.empty() && !t->handler.remark.empty())
+                    error = "Overpass result truncated for tile " + std::to_string(i + 1) + "/" +
+                            std::to_string(tiles.size()) + ": " + t->handler.remark;
+                failed = true;
+            }
+        }
+
+        if (active > 0)
+            curl_multi_wait(multi, nullptr, 0, 1000, nullptr);
+    }
+    curl_multi_cleanup(multi);
+
+    if (!error.empty())
+        throw std::runtime_error(error);
+    if (failed || next_stitch < tiles.size())
+    {
+        std::cerr << "Overpass fetch incomplete: " << next_stitch << "/" << tiles.size() << " tiles" << std::endl;
+        return false;
+    }
+
+    std::cout << "Successfully fetched and parsed " << stats.bytes << " bytes from Overpass API ("
+              << stats.tiles << " tile(s), " << stats.cache_hits << " from cache, "
+              << stats.duplicate_ways << " duplicate ways dropped)" << std::endl;
+    return true;
+}
+
+// Freezes the graph stitched by fetch_overpass_graph into CSR form
+void build_graph_from_overpass(const OverpassFetchStats &stats)
+{
+    std::cout << "Building graph from real OSM node/way data..." << std::endl;
+
+    if (nodes.empty())
+    {
+        std::cerr << "ERROR: No valid elements in OSM data!" << std::endl;
+        return;
+    }
+    std::cout << "Stored " << nodes.size() << " unique nodes from OSM data" << std::endl;
+    std::cout << "Built graph with " << nodes.size() << " nodes and "
+              << stats.edge_count << " directed edges" << std::endl;
+    std::cout << "Found " << stats.oneway_count << " one-way street segments" << std::endl;
+
+    // freeze into CSR form (also computes connected components)
+    finalize_road_graph();
+}
+
+void generate_simulated_graph_fallback(double min_lat, double min_lon, double max_lat, double max_lon)
+{
+    std::cout << "\n=== FALLBACK: Generating simulated road network ===" << std::endl;
+
+    nodes.clear();
+    graph.clear();
+    road_graph.clear();
+    node_component.clear();
+
+    const int GRID_SIZE = 80;
+    double lat_step = (max_lat - min_lat) / GRID_SIZE;
+    double lon_step = (max_lon - min_lon) / GRID_SIZE;
+
+    long node_id = 1;
+    std::vector<std::vector<long>> grid_nodes(GRID_SIZE, std::vector<long>(GRID_SIZE));
+
+    for (int i = 0; i < GRID_SIZE; i++)
+    {
+        for (int j = 0; j < GRID_SIZE; j++)
+        {
+            double lat = min_lat + i * lat_step;
+            double lon = min_lon + j * lon_step;
+            nodes[node_id] = {node_id, lat, lon};
+            grid_nodes[i][j] = node_id;
+            node_id++;
+        }
+    }
+
+    for (int i = 0; i < GRID_SIZE; i++)
+    {
+        for (int j = 0; j < GRID_SIZE; j++)
+        {
+            long current = grid_nodes[i][j];
+
+            std::vector<std::pair<int, int>> directions = {
+                {0, 1}, {1, 0}, {1, 1}, {1, -1}, {0, -1}, {-1, 0}, {-1, -1}, {-1, 1}};
+
+            for (const auto &dir : directions)
+            {
+                int ni = i + dir.first;
+                int nj = j + dir.second;
+
+                if (ni >= 0 && ni < GRID_SIZE && nj >= 0 && nj < GRID_SIZE)
+                {
+                    long neighbor = grid_nodes[ni][nj];
+                    double dist = haversine(nodes[current].lat, nodes[current].lon,
+                                            nodes[neighbor].lat, nodes[neighbor].lon);
+
+                    bool exists = false;
+                    for (const auto &edge : graph[current])
+                    {
+                        if (edge.first == neighbor)
+                        {
+                            exists = true;
+                            break;
+                        }
+                    }
+                    if (!exists)
+                    {
+                        graph[current].push_back({neighbor, dist});
+                    }
+                }
+            }
+        }
+    }
+
+    std::cout << "Simulated graph: " << nodes.size() << " nodes" << std::endl;
+
+    // freeze into CSR form (also computes components for simulated graph)
+    finalize_road_graph();
+}
+
+// ==================== OFFLINE OSM FILES ====================
+
+// Streaming readers for local .osm (XML) and .osm.pbf extracts. A reader
+// reports elements through these callbacks; the want_* flags let a pass skip
+// decoding what it does not need.
+struct OsmHandler
+{
+    bool want_nodes = false;
+    bool want_ways = false;
+    std::function<void(long id, double lat, double lon)> node;
+    std::function<void(long id, const std::vector<long> &refs, const std::vector<std::pair<std::string, std::string>> &tags)> way;
+};
+
+// --- XML ---
+
+// Pulls one markup tag at a time ("node id=..." without the angle brackets)
+// from a file read in fixed-size chunks
+class XmlTagReader
+{
+public:
+    explicit XmlTagReader(std::ifstream &in_) : in(in_) {}
+
+    bool next(std::string &tag)
+    {
+        while (true)
+        {
+            size_t open = buffer.find('<', pos);
+            if (open == std::string::npos)
+            {
+                buffer.clear();
+                pos = 0;
+                if (!fill())
+                    return false;
+                continue;
+            }
+
+            // Find the closing '>' outside quoted attribute values
+            char quote = 0;
+            size_t close = std::string::npos;
+            for (size_t i = open + 1; i < buffer.size(); i++)
+            {
+                char ch = buffer[i];
+                if (quote)
+                {
+                    if (ch == quote)
+                        quote = 0;
+                }
+                else if (ch == '"' || ch == '\'')
+                    quote = ch;
+                else if (ch == '>')
+                {
+                    close = i;
+                    break;
+                }
+            }
+            if (close == std::string::npos)
+            {
+                buffer.erase(0, open);
+                pos = 0;
+                if (!fill())
+                    return false;
+                continue;
+            }
+
+            tag.assign(buffer, open + 1, close - open - 1);
+            pos = close + 1;
+            return true;
+        }
+    }
+
+private:
+    bool fill()
+    {
+        char chunk[1 << 16];
+        in.read(chunk, sizeof(chunk));
+        std::streamsize got = in.gcount();
+        if (got <= 0)
+            return false;
+        buffer.append(chunk, (size_t)got);
+        return true;
+    }
+
+    std::ifstream &in;
+    std::string buffer;
+    size_t pos = 0;
+};
+
+// Value of attribute `name` in a tag, with the five predefined entities decoded
+bool xml_attribute(const std::string &tag, const char *name, std::string &value)
+{
+    size_t name_len = std::strlen(name);
+    size_t at = 0;
+    while ((at = tag.find(name, at)) != std::string::npos)
+    {
+        size_t eq = at + name_len;
+        bool starts_word = at > 0 && std::isspace((unsigned char)tag[at - 1]);
+        if (starts_word && eq + 1 < tag.size() && tag[eq] == '=' && (tag[eq + 1] == '"' || tag[eq + 1] == '\''))
+        {
+            size_t end = tag.find(tag[eq + 1], eq + 2);
+            if (end == std::string::npos)
+                return false;
+            value.clear();
+            for (size_t i = eq + 2; i < end; i++)
+            {
+                if (tag[i] != '&')
+                {
+                    value += tag[i];
+                    continue;
+                }
+                static const std::pair<const char *, char> entities[] = {
+                    {"&amp;", '&'}, {"&lt;", '<'}, {"&gt;", '>'}, {"&quot;", '"'}, {"&apos;", '\''}};
+                bool decoded = false;
+                for (const auto &[entity, ch] : entities)
+                {
+                    size_t len = std::strlen(entity);
+                    if (tag.compare(i, len, entity) == 0)
+                    {
+                        value += ch;
+                        i += len - 1;
+                        decoded = true;
+                        break;
+                    }
+                }
+                if (!decoded)
+                    value += '&';
+            }
+            return true;
+        }
+        at = eq;
+    }
+    return false;
+}
+
+bool element_is(const std::string &tag, const char *name)
+{
+    size_t len = std::strlen(name);
+    return tag.compare(0, len, name) == 0 &&
+           (tag.size() == len || std::isspace((unsigned char)tag[len]) || tag[len] == '/');
+}
+
+bool read_osm_xml(const std::string &path, const OsmHandler &handler, std::string &error)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open())
+    {
+        error = "cannot open " + path;
+        return false;
+    }
+
+    XmlTagReader reader(in);
+    std::string tag, id, lat, lon, key, value;
+    std::vector<long> refs;
+    std::vector<std::pair<std::string, std::string>> tags;
+    bool in_way = false;
+    long way_id = 0;
+
+    while (reader.next(tag))
+    {
+        if (handler.want_nodes && element_is(tag, "node"))
+        {
+            if (xml_attribute(tag, "id", id) && xml_attribute(tag, "lat", lat) && xml_attribute(tag, "lon", lon))
+                handler.node(std::stol(id), std::stod(lat), std::stod(lon));
+        }
+        else if (!handler.want_ways)
+        {
+            continue;
+        }
+        else if (element_is(tag, "way"))
+        {
+            // <way .../> has no children
+            in_way = tag.back() != '/';
+            way_id = xml_attribute(tag, "id", id) ? std::stol(id) : 0;
+            refs.clear();
+            tags.clear();
+        }
+        else if (in_way && element_is(tag, "nd"))
+        {
+            if (xml_attribute(tag, "ref", value))
+                refs.push_back(std::stol(value));
+        }
+        else if (in_way && element_is(tag, "tag"))
+        {
+            if (xml_attribute(tag, "k", key) && xml_attribute(tag, "v", value))
+                tags.push_back({key, value});
+        }
+        else if (in_way && element_is(tag, "/way"))
+        {
+            handler.way(way_id, refs, tags);
+            in_way = false;
+        }
+    }
+
+    if (in.bad())
+    {
+        error = "read error in " + path;
+        return false;
+    }
+    return true;
+}
+
+// --- PBF ---
+
+// Protocol Buffers wire-format reader over a byte range. Sets `bad` instead
+// of reading past the end.
+class ProtoReader
+{
+public:
+    ProtoReader(const uint8_t *begin, const uint8_t *end_) : p(begin), end(end_) {}
+
+    bool next(uint32_t &field, uint32_t &wire_type)
+    {
+        if (p >= end || bad)
+            return false;
+        uint64_t key = varint();
+        field = (uint32_t)(key >> 3);
+        wire_type = (uint32_t)(key & 7);
+        return !bad;
+    }
+
+    uint64_t varint()
+    {
+        uint64_t result = 0;
+        for (int shift = 0; shift < 64; shift += 7)
+        {
+            if (p >= end)
+            {
+                bad = true;
+                return 0;
+            }
+            uint8_t byte = *p++;
+            result |= (uint64_t)(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                return result;
+        }
+        bad = true;
+        return 0;
+    }
+
+    int64_t svarint()
+    {
+        uint64_t v = varint();
+        return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+    }
+
+    ProtoReader bytes()
+    {
+        uint64_t len = varint();
+        if (bad || len > (uint64_t)(end - p))
+        {
+            bad = true;
+            return ProtoReader(end, end);
+        }
+        ProtoReader sub(p, p + len);
+        p += len;
+        return sub;
+    }
+
+    void skip(uint32_t wire_type)
+    {
+        if (wire_type == 0)
+            varint();
+        else if (wire_type == 2)
+            bytes();
+        else if (wire_type == 1 && end - p >= 8)
+            p += 8;
+        else if (wire_type == 5 && end - p >= 4)
+            p += 4;
+        else
+            bad = true;
+    }
+
+    std::string str() const { return std::string((const char *)p, (const char *)end); }
+
+    const uint8_t *p;
+    const uint8_t *end;
+    bool bad = false;
+};
+
+struct PbfBlock
+{
+    std::vector<std::string> strings;
+    int64_t granularity = 100;
+    int64_t lat_offset = 0;
+    int64_t lon_offset = 0;
+
+    double lat(int64_t raw) const { return 1e-9 * (lat_offset + granularity * raw); }
+    double lon(int64_t raw) const { return 1e-9 * (lon_offset + granularity * raw); }
+};
+
+bool pbf_dense_nodes(ProtoReader dense, const PbfBlock &block, const OsmHandler &handler)
+{
+    std::vector<int64_t> ids, lats, lons;
+    uint32_t field, wire_type;
+    while (dense.next(field, wire_type))
+    {
+        if (wire_type == 2 && (field == 1 || field == 8 || field == 9))
+        {
+            auto &out = field == 1 ? ids : field == 8 ? lats : lons;
+            ProtoReader packed = dense.bytes();
+            int64_t running = 0;
+            while (packed.p < packed.end && !packed.bad)
+                out.push_back(running += packed.svarint());
+            dense.bad |= packed.bad;
+        }
+        else
+            dense.skip(wire_type);
+    }
+    if (dense.bad || ids.size() != lats.size() || ids.size() != lons.size())
+        return false;
+    for (size_t i = 0; i < ids.size(); i++)
+        handler.node((long)ids[i], block.lat(lats[i]), block.lon(lons[i]));
+    return true;
+}
+
+bool pbf_node(ProtoReader node, const PbfBlock &block, const OsmHandler &handler)
+{
+    int64_t id = 0, lat = 0, lon = 0;
+    uint32_t field, wire_type;
+    while (node.next(field, wire_type))
+    {
+        if (field == 1 && wire_type == 0)
+            id = node.svarint();
+        else if (field == 8 && wire_type == 0)
+            lat = node.svarint();
+        else if (field == 9 && wire_type == 0)
+            lon = node.svarint();
+        else
+            node.skip(wire_type);
+    }
+    if (node.bad)
+        return false;
+    handler.node((long)id, block.lat(lat), block.lon(lon));
+    return true;
+}
+
+bool pbf_way(ProtoReader way, const PbfBlock &block, const OsmHandler &handler,
+             std::vector<long> &refs, std::vector<std::pair<std::string, std::string>> &tags)
+{
+    std::vector<uint32_t> keys, vals;
+    refs.clear();
+    tags.clear();
+    long id = 0;
+    uint32_t field, wire_type;
+    while (way.next(field, wire_type))
+    {
+        if (wire_type == 0 && field == 1)
+            id = (long)way.varint();
+        else if (wire_type == 2 && (field == 2 || field == 3))
+        {
+            auto &out = field == 2 ? keys : vals;
+            ProtoReader packed = way.bytes();
+            while (packed.p < packed.end && !packed.bad)
+                out.push_back((uint32_t)packed.varint());
+            way.bad |= packed.bad;
+        }
+        else if (wire_type == 2 && field == 8)
+        {
+            ProtoReader packed = way.bytes();
+            int64_t running = 0;
+            while (packed.p < packed.end && !packed.bad)
+                refs.push_back((long)(running += packed.svarint()));
+            way.bad |= packed.bad;
+        }
+        else
+            way.skip(wire_type);
+    }
+    if (way.bad || keys.size() != vals.size())
+        return false;
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        if (keys[i] >= block.strings.size() || vals[i] >= block.strings.size())
+            return false;
+        tags.push_back({block.strings[keys[i]], block.strings[vals[i]]});
+    }
+    handler.way(id, refs, tags);
+    return true;
+}
+
+bool pbf_primitive_block(const uint8_t *data, size_t size, const OsmHandler &handler)
+{
+    PbfBlock block;
+    std::vector<ProtoReader> groups;
+    ProtoReader reader(data, data + size);
+    uint32_t field, wire_type;
+    while (reader.next(field, wire_type))
+    {
+        if (field == 1 && wire_type == 2)
+        {
+            ProtoReader table = reader.bytes();
+            while (table.next(field, wire_type))
+            {
+                if (field == 1 && wire_type == 2)
+                    block.strings.push_back(table.bytes().str());
+                else
+                    table.skip(wire_type);
+            }
+            reader.bad |= table.bad;
+        }
+        else if (field == 2 && wire_type == 2)
+            groups.push_back(reader.bytes());
+        else if (field == 17 && wire_type == 0)
+            block.granularity = (int64_t)reader.varint();
+        else if (field == 19 && wire_type == 0)
+            block.lat_offset = (int64_t)reader.varint();
+        else if (field == 20 && wire_type == 0)
+            block.lon_offset = (int64_t)reader.varint();
+        else
+            reader.skip(wire_type);
+    }
+    if (reader.bad)
+        return false;
+
+    std::vector<long> refs;
+    std::vector<std::pair<std::string, std::string>> tags;
+    for (ProtoReader group : groups)
+    {
+        while (group.next(field, wire_type))
+        {
+            bool ok = true;
+            if (field == 1 && wire_type == 2 && handler.want_nodes)
+                ok = pbf_node(group.bytes(), block, handler);
+            else if (field == 2 && wire_type == 2 && handler.want_nodes)
+                ok = pbf_dense_nodes(group.bytes(), block, handler);
+            else if (field == 3 && wire_type == 2 && handler.want_ways)
+                ok = pbf_way(group.bytes(), block, handler, refs, tags);
+            else
+                group.skip(wire_type);
+            if (!ok)
+                return false;
+        }
+        if (group.bad)
+            return false;
+    }
+    return true;
+}
+
+// File = repeated (4-byte big-endian BlobHeader length, BlobHeader, Blob).
+// Only one blob is held in memory at a time.
+bool read_osm_pbf(const std::string &path, const OsmHandler &handler, std::string &error)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open())
+    {
+        error = "cannot open " + path;
+        return false;
+    }
+
+    std::vector<uint8_t> header_buf, blob_buf, raw;
+    while (true)
+    {
+        uint8_t len_bytes[4];
+        if (!in.read(reinterpret_cast<char *>(len_bytes), 4))
+            break;
+        uint32_t header_len = (uint32_t)len_bytes[0] << 24 | (uint32_t)len_bytes[1] << 16 |
+                              (uint32_t)len_bytes[2] << 8 | len_bytes[3];
+        if (header_len > 64 * 1024)
+        {
+            error = "BlobHeader too large";
+            return false;
+        }
+        header_buf.resize(header_len);
+        if (!in.read(reinterpret_cast<char *>(header_buf.data()), header_len))
+        {
+            error = "truncated BlobHeader";
+            return false;
+        }
+
+        std::string type;
+        uint64_t data_size = 0;
+        ProtoReader header(header_buf.data(), header_buf.data() + header_len);
+        uint32_t field, wire_type;
+        while (header.next(field, wire_type))
+        {
+            if (field == 1 && wire_type == 2)
+                type = header.bytes().str();
+            else if (field == 3 && wire_type == 0)
+                data_size = header.varint();
+            else
+                header.skip(wire_type);
+        }
+        if (header.bad || data_size > 32 * 1024 * 1024)
+        {
+            error = "malformed BlobHeader";
+            return false;
+        }
+
+        blob_buf.resize(data_size);
+        if (!in.read(reinterpret_cast<char *>(blob_buf.data()), data_size))
+        {
+            error = "truncated Blob";
+            return false;
+        }
+        if (type != "OSMData")
+            continue; // OSMHeader: nothing needed from it
+
+        const uint8_t *block_data = nullptr;
+        size_t block_size = 0;
+        uint64_t raw_size = 0;
+        ProtoReader blob(blob_buf.data(), blob_buf.data() + data_size);
+        while (blob.next(field, wire_type))
+        {
+            if (field == 1 && wire_type == 2)
+            {
+                ProtoReader payload = blob.bytes();
+                block_data = payload.p;
+                block_size = payload.end - payload.p;
+            }
+            else if (field == 2 && wire_type == 0)
+                raw_size = blob.varint();
+            else if (field == 3 && wire_type == 2)
+            {
+                ProtoReader payload = blob.bytes();
+                if (raw_size == 0 || raw_size > 32 * 1024 * 1024)
+                {
+                    error = "bad raw_size in Blob";
+                    return false;
+                }
+                raw.resize(raw_size);
+                uLongf out_len = (uLongf)raw_size;
+                if (uncompress(raw.data(), &out_len, payload.p, (uLong)(payload.end - payload.p)) != Z_OK)
+                {
+                    error = "zlib error in Blob";
+                    return false;
+                }
+                block_data = raw.data();
+                block_size = out_len;
+            }
+            else if (field >= 4 && field <= 7)
+            {
+                error = "unsupported Blob compression (only raw and zlib)";
+                return false;
+            }
+            else
+                blob.skip(wire_type);
+        }
+        if (blob.bad || !block_data)
+        {
+            error = "malformed Blob";
+            return false;
+        }
+        if (!pbf_primitive_block(block_data, block_size, handler))
+        {
+            error = "malformed PrimitiveBlock";
+            return false;
+        }
+    }
+    return true;
+}
+
+// --- Graph building ---
+
+bool ends_with(const std::string &value, const std::string &suffix)
+{
+    return value.size() >= suffix.size() &&
+           value.compare(value.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Builds the road graph from a local extract in two streaming passes: ways
+// first (keeping only highway ways of the requested detail level and marking
+// their nodes), then nodes (keeping coordinates only for marked ids). Memory
+// grows with the road network, not with the file. Edges are made exactly as
+// in build_graph_from_overpass.
+bool build_graph_from_osm_file(const std::string &path, const std::string &graph_detail, std::string &error)
+{
+    std::cout << "Building graph from local OSM file " << path << "..." << std::endl;
+
+    nodes.clear();
+    graph.clear();
+    road_graph.clear();
+    node_component.clear();
+
+    bool is_pbf = ends_with(path, ".pbf");
+    auto read = [&](const OsmHandler &handler)
+    {
+        return is_pbf ? read_osm_pbf(path, handler, error) : read_osm_xml(path, handler, error);
+    };
+
+    std::string highway_types = highway_types_for_detail(graph_detail);
+
+    // Pass 1: matching ways, stored as flat node-id runs
+    WayBuffer way_buffer;
+    const double UNSET = std::numeric_limits<double>::quiet_NaN();
+    OsmHandler ways;
+    ways.want_ways = true;
+    ways.way = [&](long id, const std::vector<long> &refs, const std::vector<std::pair<std::string, std::string>> &tags)
+    {
+        std::string highway, oneway, maxspeed;
+        for (const auto &[k, v] : tags)
+        {
+            if (k == "highway")
+                highway = v;
+            else if (k == "oneway")
+                oneway = v;
+            else if (k == "maxspeed")
+                maxspeed = v;
+        }
+        if (highway.empty() || !highway_matches(highway, highway_types) || refs.size() < 2)
+            return;
+        way_buffer.add(id, make_way_info(highway, oneway, maxspeed), refs);
+        for (long ref : refs)
+            nodes.try_emplace(ref, Node{ref, UNSET, UNSET});
+    };
+    if (!read(ways))
+        return false;
+    std::cout << "Pass 1: " << way_buffer.size() << " highway ways referencing "
+              << nodes.size() << " nodes" << std::endl;
+
+    // Pass 2: coordinates of the marked nodes only
+    OsmHandler coords;
+    coords.want_nodes = true;
+    coords.node = [&](long id, double lat, double lon)
+    {
+        auto it = nodes.find(id);
+        if (it != nodes.end())
+        {
+            it->second.lat = lat;
+            it->second.lon = lon;
+        }
+    };
+    if (!read(coords))
+        return false;
+
+    size_t missing = 0;
+    for (auto it = nodes.begin(); it != nodes.end();)
+    {
+        if (std::isnan(it->second.lat))
+        {
+            it = nodes.erase(it);
+            missing++;
+        }
+        else
+            ++it;
+    }
+    std::cout << "Pass 2: stored " << nodes.size() << " node coordinates ("
+              << missing << " referenced nodes not in file)" << std::endl;
+
+    int edge_count = 0;
+    int oneway_count = 0;
+    add_buffered_way_edges(way_buffer, edge_count, oneway_count);
+
+    std::cout << "Built graph with " << nodes.size() << " nodes and "
+              << edge_count << " directed edges" << std::endl;
+    std::cout << "Found " << oneway_count << " one-way street segments" << std::endl;
+
+    finalize_road_graph();
+    return true;
+}
+
+// ==================== DIJKSTRA ALGORITHM ====================
+
+// One-to-all search from start_node into ws; distances and parents are read
+// back with ws.distance(u) / ws.parent_of(u) by dense road_graph index, the
+// source being its own parent
+void dijkstra(long start_node, SearchWorkspace &ws)
+{
+    ws.reset(road_graph.num_nodes());
+    auto &queue = ws.queue;
+
+    int start = road_graph.index(start_node);
+    if (start == -1)
+        return;
+
+    ws.set(start, 0.0, start);
+    queue.push(start, 0.0);
+
+    while (!queue.empty())
+    {
+        int current_node = queue.pop();
+        double current_dist = ws.distance(current_node);
+
+        for (int e = road_graph.offsets[current_node]; e < road_graph.offsets[current_node + 1]; e++)
+        {
+            int neighbor = road_graph.targets[e];
+            double new_dist = current_dist + road_graph.weights[e];
+
+            if (new_dist < ws.distance(neighbor))
+            {
+                ws.set(neighbor, new_dist, current_node);
+                queue.push(neighbor, new_dist);
+            }
+        }
+    }
+}
+
+// dijkstra() on edge weights rounded down to ticks, with a radix heap instead
+// of the comparison heap. ws.distance(u) is in seconds again afterwards and
+// ws.aux_of(u) is the number of edges on u's tree path, so the true distance
+// lies in [ws.distance(u), ws.distance(u) + ws.aux_of(u) / WEIGHT_TICKS_PER_SECOND).
+void dijkstra_ticks(long start_node, SearchWorkspace &ws)
+{
+    ws.reset(road_graph.num_nodes());
+    auto &queue = ws.radix;
+
+    int start = road_graph.index(start_node);
+    if (start == -1)
+        return;
+
+    // Tick distances are exact integers, so they are kept in the double
+    // distance array until the search ends
+    ws.set(start, 0.0, start, 0);
+    queue.push(0, start);
+
+    while (!queue.empty())
+    {
+        auto [current_ticks, current_node] = queue.pop();
+        if (current_ticks > ws.distance(current_node))
+            continue;
+        int hops = ws.aux_of(current_node) + 1;
+
+        for (int e = road_graph.offsets[current_node]; e < road_graph.offsets[current_node + 1]; e++)
+        {
+            int neighbor = road_graph.targets[e];
+            uint32_t new_ticks = current_ticks + weight_ticks(road_graph.weights[e]);
+
+            if (new_ticks < ws.distance(neighbor))
+            {
+                ws.set(neighbor, new_ticks, current_node, hops);
+                queue.push(new_ticks, neighbor);
+            }
+        }
+    }
+    ws.scale_distances(1.0 / WEIGHT_TICKS_PER_SECOND);
+}
+
+// Largest quantization error of dijkstra_ticks() at node u, in seconds
+double ticks_error_bound(const SearchWorkspace &ws, int u)
+{
+    return ws.visited(u) ? ws.aux_of(u) / WEIGHT_TICKS_PER_SECOND : 0.0;
+}
+
+// ==================== PARALLEL DIJKSTRA FUNCTIONS ====================
+
+struct DijkstraResult
+{
+    std::string centre_id;
+    long start_node;
+    int reachable_nodes = 0;
+    long long computation_time_ms = 0;
+    bool success = false;
+    bool saved_to_files = false;
+    std::string distances_file;
+    std::string parents_file;
+    std::string error_message;
+    double error_bound_seconds = 0.0; // integer weights: true distances exceed the reported ones by less than this
+};
+
+bool save_dijkstra_results(const DijkstraResult &result,
+                           const SearchWorkspace &ws,
+                           const std::string &distances_file,
+                           const std::string &parents_file);
+
+// Run Dijkstra for a single centre on a pool worker. Only the summary is
+// kept; the full distance/parent arrays live in the worker thread's
+// workspace and are written out here if requested.
+DijkstraResult run_dijkstra_for_centre(const Centre &centre, bool integer_weights,
+                                       bool save_to_files, const std::string &output_dir)
+{
+    DijkstraResult result;
+    result.centre_id = centre.centre_id;
+    result.start_node = centre.snapped_node_id;
+
+    try
+    {
+        auto start_time = std::chrono::high_resolution_clock::now();
+
+        SearchWorkspace &ws = thread_workspace();
+        if (integer_weights)
+            dijkstra_ticks(centre.snapped_node_id, ws);
+        else
+            dijkstra(centre.snapped_node_id, ws);
+
+        auto end_time = std::chrono::high_resolution_clock::now();
+        result.computation_time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                         end_time - start_time)
+                                         .count();
+
+        result.reachable_nodes = (int)ws.reached_nodes().size();
+        if (integer_weights)
+        {
+            for (int u : ws.reached_nodes())
+                result.error_bound_seconds = std::max(result.error_bound_seconds, ticks_error_bound(ws, u));
+        }
+        result.success = true;
+
+        if (save_to_files)
+        {
+            result.distances_file = output_dir + centre.centre_id + "_distances.json";
+            result.parents_file = output_dir + centre.centre_id + "_parents.json";
+            result.saved_to_files = save_dijkstra_results(result, ws, result.distances_file, result.parents_file);
+        }
+
+        std::cout << "✓ Completed Dijkstra for " << centre.centre_id
+                  << " in " << result.computation_time_ms << "ms" << std::endl;
+    }
+    catch (const std::exception &e)
+    {
+        result.success = false;
+        result.error_message = e.what();
+        std::cerr << "✗ Error in Dijkstra for " << centre.centre_id
+                  << ": " << e.what() << std::endl;
+    }
+
+    return result;
+}
+
+// Save Dijkstra results to JSON files
+bool save_dijkstra_results(const DijkstraResult &result,
+                           const SearchWorkspace &ws,
+                           const std::string &distances_file,
+                           const std::string &parents_file)
+{
+    try
+    {
+        // Save distances
+        json distances_json = json::object();
+        for (int u : ws.reached_nodes())
+        {
+            distances_json[std::to_string(road_graph.osm_ids[u])] = ws.distance(u);
+        }
+
+        std::ofstream dist_out(distances_file);
+        if (!dist_out.is_open())
+        {
+            std::cerr << "Failed to open " << distances_file << std::endl;
+            return false;
+        }
+        dist_out << distances_json.dump(2);
+        dist_out.close();
+
+        // Save parents
+        json parents_json = json::object();
+        for (int u : ws.reached_nodes())
+        {
+            parents_json[std::to_string(road_graph.osm_ids[u])] = road_graph.osm_ids[ws.parent_of(u)];
+        }
+
+        std::ofstream parent_out(parents_file);
+        if (!parent_out.is_open())
+        {
+            std::cerr << "Failed to open " << parents_file << std::endl;
+            return false;
+        }
+        parent_out << parents_json.dump(2);
+        parent_out.close();
+
+        std::cout << "✓ Saved results for " << result.centre_id << std::endl;
+        std::cout << "  - Distances: " << distances_file << std::endl;
+        std::cout << "  - Parents: " << parents_file << std::endl;
+
+        return true;
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Error saving results: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+// ==================== A* ALGORITHM ====================
+
+// A* from the cheapest of several sources (dense indices)
+std::vector<long> a_star(const std::vector<SearchSeed> &sources, int goal, SearchStats *stats)
+{
+    SearchWorkspace &ws = thread_workspace();
+    ws.reset(road_graph.num_nodes());
+    auto &open_set = ws.queue; // keyed by f = g + h
+
+    for (const SearchSeed &seed : sources)
+    {
+        if (seed.cost >= ws.distance(seed.node))
+            continue;
+        ws.set(seed.node, seed.cost, -1);
+        open_set.push(seed.node, seed.cost + heuristic(seed.node, goal));
+    }
+
+    while (!open_set.empty())
+    {
+        int current = open_set.pop();
+        double g_score = ws.distance(current);
+        if (stats)
+            stats->settled++;
+
+        if (current == goal)
+        {
+            if (stats)
+                stats->distance = g_score;
+            std::vector<long> path;
+            int node = goal;
+            while (ws.parent_of(node) != -1)
+            {
+                path.push_back(road_graph.osm_ids[node]);
+                node = ws.parent_of(node);
+            }
+            path.push_back(road_graph.osm_ids[node]);
+            std::reverse(path.begin(), path.end());
+            return path;
+        }
+
+        for (int e = road_graph.offsets[current]; e < road_graph.offsets[current + 1]; e++)
+        {
+            int neighbor = road_graph.targets[e];
+            double tentative_g_score = g_score + road_graph.weights[e];
+
+            if (tentative_g_score < ws.distance(neighbor))
+            {
+                ws.set(neighbor, tentative_g_score, current);
+                open_set.push(neighbor, tentative_g_score + heuristic(neighbor, goal));
+            }
+        }
+    }
+
+    return {};
+}
+
+std::vector<long> a_star(long start_node, long goal_node, SearchStats *stats = nullptr)
+{
+    int start = road_graph.index(start_node);
+    int goal = road_graph.index(goal_node);
+    if (start == -1 || goal == -1)
+        return {};
+    return a_star({{start, 0.0}}, goal, stats);
+}
+
+// ==================== CONTRACTION HIERARCHIES ====================
+
+// Nodes are contracted in order of rank; every remaining edge points to a
+// higher-ranked node. up_* holds edges u->v with rank[v] > rank[u] (used by
+// the forward search); down_* holds edges u->v with rank[u] > rank[v],
+// stored at v with target u (used by the backward search). A shortcut
+// remembers the contracted node it bypasses in *_middle (-1 for road edges).
+struct ContractionHierarchy
+{
+    std::vector<int> rank;
+
+    std::vector<int> up_offsets;
+    std::vector<int> up_targets;
+    std::vector<double> up_weights;
+    std::vector<int> up_middle;
+
+    std::vector<int> down_offsets;
+    std::vector<int> down_targets;
+    std::vector<double> down_weights;
+    std::vector<int> down_middle;
+
+    int num_shortcuts = 0;
+    int core_size = 0;
+
+    bool ready() const { return !rank.empty() && rank.size() == (size_t)road_graph.num_nodes(); }
+
+    void clear()
+    {
+        rank.clear();
+        up_offsets.clear();
+        up_targets.clear();
+        up_weights.clear();
+        up_middle.clear();
+        down_offsets.clear();
+        down_targets.clear();
+        down_weights.clear();
+        down_middle.clear();
+        num_shortcuts = 0;
+        core_size = 0;
+    }
+};
+
+ContractionHierarchy contraction_hierarchy;
+
+// Nodes whose overlay degree exceeds this are left uncontracted in the core
+const size_t CH_CORE_DEGREE = 40;
+
+struct CHEdge
+{
+    int node;
+    double weight;
+    int middle;
+};
+
+// Dynamic overlay graph used while contracting, plus witness-search scratch
+class CHBuilder
+{
+public:
+    explicit CHBuilder(int n)
+        : out_edges(n), in_edges(n), contracted(n, false), deleted_neighbours(n, 0), level(n, 0),
+          witness_dist(n, std::numeric_limits<double>::max()), witness_target(n, false) {}
+
+    std::vector<std::vector<CHEdge>> out_edges;
+    std::vector<std::vector<CHEdge>> in_edges;
+    std::vector<bool> contracted;
+    std::vector<int> deleted_neighbours;
+    std::vector<int> level;
+
+    void add_or_improve(int u, int x, double weight, int middle)
+    {
+        for (auto &e : out_edges[u])
+        {
+            if (e.node == x)
+            {
+                if (weight < e.weight)
+                {
+                    e.weight = weight;
+                    e.middle = middle;
+                    for (auto &r : in_edges[x])
+                    {
+                        if (r.node == u)
+                        {
+                            r.weight = weight;
+                            r.middle = middle;
+                            break;
+                        }
+                    }
+                }
+                return;
+            }
+        }
+        out_edges[u].push_back({x, weight, middle});
+        in_edges[x].push_back({u, weight, middle});
+    }
+
+    // Shortcuts needed to contract v; added to the overlay unless simulating.
+    // Simulation uses a much smaller witness budget: it only ranks nodes.
+    int contract(int v, bool simulate)
+    {
+        const int settle_limit = simulate ? SIMULATE_SETTLE_LIMIT : WITNESS_SETTLE_LIMIT;
+        double max_out = 0.0;
+        for (const auto &e : out_edges[v])
+            max_out = std::max(max_out, e.weight);
+
+        std::vector<std::pair<int, std::pair<int, double>>> shortcuts;
+        for (const auto &in : in_edges[v])
+        {
+            int u = in.node;
+            witness_search(u, v, in.weight + max_out, settle_limit);
+            for (const auto &out : out_edges[v])
+            {
+                int x = out.node;
+                if (x == u)
+                    continue;
+                double via = in.weight + out.weight;
+                // equal-length witnesses are common on grids; tolerate rounding
+                if (witness_dist[x] <= via + 1e-9 * via)
+                    continue;
+                shortcuts.push_back({u, {x, via}});
+            }
+            reset_witness();
+        }
+
+        if (!simulate)
+        {
+            for (const auto &[u, target] : shortcuts)
+                add_or_improve(u, target.first, target.second, v);
+        }
+        return (int)shortcuts.size();
+    }
+
+    int priority(int v)
+    {
+        int shortcuts = contract(v, true);
+        int removed = (int)(in_edges[v].size() + out_edges[v].size());
+        return 2 * (shortcuts - removed) + deleted_neighbours[v] + level[v];
+    }
+
+    // Drop v from the overlay; its remaining edges all lead to higher ranks
+    void remove(int v)
+    {
+        contracted[v] = true;
+        for (const auto &e : out_edges[v])
+        {
+            auto &list = in_edges[e.node];
+            list.erase(std::remove_if(list.begin(), list.end(), [v](const CHEdge &r)
+                                      { return r.node == v; }),
+                       list.end());
+            deleted_neighbours[e.node]++;
+            level[e.node] = std::max(level[e.node], level[v] + 1);
+        }
+        for (const auto &e : in_edges[v])
+        {
+            auto &list = out_edges[e.node];
+            list.erase(std::remove_if(list.begin(), list.end(), [v](const CHEdge &r)
+                                      { return r.node == v; }),
+                       list.end());
+            deleted_neighbours[e.node]++;
+            level[e.node] = std::max(level[e.node], level[v] + 1);
+        }
+    }
+
+private:
+    static const int WITNESS_SETTLE_LIMIT = 500;
+    static const int SIMULATE_SETTLE_LIMIT = 40;
+
+    std::vector<double> witness_dist;
+    std::vector<bool> witness_target;
+    std::vector<int> witness_touched;
+    std::vector<std::pair<double, int>> witness_heap;
+
+    // Bounded Dijkstra from u that never passes through v. Stops once every
+    // out-neighbour of v is settled, past max_dist, or when the budget runs out.
+    void witness_search(int u, int v, double max_dist, int settle_limit)
+    {
+        int targets_left = 0;
+        for (const auto &e : out_edges[v])
+        {
+            if (e.node != u && !witness_target[e.node])
+            {
+                witness_target[e.node] = true;
+                targets_left++;
+            }
+        }
+
+        witness_heap.clear();
+        witness_dist[u] = 0.0;
+        witness_touched.push_back(u);
+        witness_heap.push_back({0.0, u});
+        int settled = 0;
+        auto cmp = std::greater<std::pair<double, int>>();
+
+        while (!witness_heap.empty() && settled < settle_limit && targets_left > 0)
+        {
+            std::pop_heap(witness_heap.begin(), witness_heap.end(), cmp);
+            auto [d, cur] = witness_heap.back();
+            witness_heap.pop_back();
+            if (d > witness_dist[cur])
+                continue;
+            if (d > max_dist)
+                break;
+            settled++;
+            if (witness_target[cur])
+            {
+                witness_target[cur] = false;
+                targets_left--;
+            }
+            for (const auto &e : out_edges[cur])
+            {
+                if (e.node == v)
+                    continue;
+                double nd = d + e.weight;
+                if (nd < witness_dist[e.node])
+                {
+                    if (witness_dist[e.node] == std::numeric_limits<double>::max())
+                        witness_touched.push_back(e.node);
+                    witness_dist[e.node] = nd;
+                    witness_heap.push_back({nd, e.node});
+                    std::push_heap(witness_heap.begin(), witness_heap.end(), cmp);
+                }
+            }
+        }
+
+        for (const auto &e : out_edges[v])
+            witness_target[e.node] = false;
+    }
+
+    void reset_witness()
+    {
+        for (int t : witness_touched)
+            witness_dist[t] = std::numeric_limits<double>::max();
+        witness_touched.clear();
+    }
+};
+
+void build_contraction_hierarchy()
+{
+    std::cout << "\n🔺 Building contraction hierarchy..." << std::endl;
+    auto start = std::chrono::high_resolution_clock::now();
+
+    contraction_hierarchy.clear();
+    const int n = road_graph.num_nodes();
+    if (n == 0)
+        return;
+
+    CHBuilder builder(n);
+    for (int u = 0; u < n; u++)
+    {
+        for (int e = road_graph.offsets[u]; e < road_graph.offsets[u + 1]; e++)
+        {
+            int v = road_graph.targets[e];
+            if (v != u)
+                builder.add_or_improve(u, v, road_graph.weights[e], -1);
+        }
+    }
+
+    std::priority_queue<std::pair<int, int>,
+                        std::vector<std::pair<int, int>>,
+                        std::greater<std::pair<int, int>>>
+        order;
+    // Heap entries whose key no longer matches priority[v] are stale
+    std::vector<int> priority(n);
+    for (int v = 0; v < n; v++)
+    {
+        priority[v] = builder.priority(v);
+        order.push({priority[v], v});
+    }
+
+    // Dense nodes are skipped until contracting their neighbours changes their
+    // degree; once only dense nodes remain they form the uncontracted core
+    auto is_dense = [&](int v)
+    { return builder.out_edges[v].size() + builder.in_edges[v].size() > CH_CORE_DEGREE; };
+    std::vector<char> dense(n);
+    int sparse_remaining = 0;
+    for (int v = 0; v < n; v++)
+    {
+        dense[v] = is_dense(v);
+        sparse_remaining += !dense[v];
+    }
+
+    std::vector<std::vector<CHEdge>> up(n), down(n);
+    contraction_hierarchy.rank.assign(n, -1);
+    int next_rank = 0;
+    int shortcuts = 0;
+
+    while (!order.empty() && sparse_remaining > 0)
+    {
+        auto [key, v] = order.top();
+        order.pop();
+        if (builder.contracted[v] || key != priority[v] || dense[v])
+            continue;
+
+        shortcuts += builder.contract(v, false);
+        contraction_hierarchy.rank[v] = next_rank++;
+        up[v] = builder.out_edges[v];
+        down[v] = builder.in_edges[v];
+        builder.remove(v);
+        sparse_remaining--;
+
+        // Neighbours lost an edge and may have gained shortcuts; refresh their keys
+        std::vector<int> neighbours;
+        for (const auto &e : up[v])
+            neighbours.push_back(e.node);
+        for (const auto &e : down[v])
+            neighbours.push_back(e.node);
+        std::sort(neighbours.begin(), neighbours.end());
+        neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+        for (int u : neighbours)
+        {
+            priority[u] = builder.priority(u);
+            order.push({priority[u], u});
+            bool now_dense = is_dense(u);
+            sparse_remaining += (int)dense[u] - (int)now_dense;
+            dense[u] = now_dense;
+        }
+    }
+
+    // Core nodes keep every overlay edge in both search graphs, so a query
+    // degrades to plain bidirectional Dijkstra once it reaches the core
+    for (int v = 0; v < n; v++)
+    {
+        if (builder.contracted[v])
+            continue;
+        contraction_hierarchy.rank[v] = next_rank++;
+        up[v] = builder.out_edges[v];
+        down[v] = builder.in_edges[v];
+        contraction_hierarchy.core_size++;
+    }
+
+    auto flatten = [n](const std::vector<std::vector<CHEdge>> &lists, std::vector<int> &offsets,
+                       std::vector<int> &targets, std::vector<double> &weights, std::vector<int> &middle)
+    {
+        offsets.assign(n + 1, 0);
+        for (int v = 0; v < n; v++)
+            offsets[v + 1] = offsets[v] + (int)lists[v].size();
+        targets.reserve(offsets[n]);
+        weights.reserve(offsets[n]);
+        middle.reserve(offsets[n]);
+        for (int v = 0; v < n; v++)
+        {
+            for (const auto &e : lists[v])
+            {
+                targets.push_back(e.node);
+                weights.push_back(e.weight);
+                middle.push_back(e.middle);
+            }
+        }
+    };
+    flatten(up, contraction_hierarchy.up_offsets, contraction_hierarchy.up_targets,
+            contraction_hierarchy.up_weights, contraction_hierarchy.up_middle);
+    flatten(down, contraction_hierarchy.down_offsets, contraction_hierarchy.down_targets,
+            contraction_hierarchy.down_weights, contraction_hierarchy.down_middle);
+    contraction_hierarchy.num_shortcuts = shortcuts;
+
+    auto end = std::chrono::high_resolution_clock::now();
+    long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+    std::cout << "✅ Contraction hierarchy built: " << shortcuts << " shortcuts, "
+              << contraction_hierarchy.up_targets.size() + contraction_hierarchy.down_targets.size()
+              << " CH edges in " << ms << "ms" << std::endl;
+}
+
+// Append the road nodes of CH edge a->b (via middle) to path, excluding a
+void ch_unpack_edge(int a, int b, int middle, std::vector<int> &path)
+{
+    const auto &ch = contraction_hierarchy;
+    std::vector<std::array<int, 3>> stack = {{a, b, middle}};
+    while (!stack.empty())
+    {
+        auto [from, to, mid] = stack.back();
+        stack.pop_back();
+        if (mid == -1)
+        {
+            path.push_back(to);
+            continue;
+        }
+
+        // from->mid is a downward edge stored at mid, mid->to an upward edge of mid
+        int first_middle = -1, second_middle = -1;
+        for (int e = ch.down_offsets[mid]; e < ch.down_offsets[mid + 1]; e++)
+        {
+            if (ch.down_targets[e] == from)
+            {
+                first_middle = ch.down_middle[e];
+                break;
+            }
+        }
+        for (int e = ch.up_offsets[mid]; e < ch.up_offsets[mid + 1]; e++)
+        {
+            if (ch.up_targets[e] == to)
+            {
+                second_middle = ch.up_middle[e];
+                break;
+            }
+        }
+        stack.push_back({mid, to, second_middle});
+        stack.push_back({from, mid, first_middle});
+    }
+}
+
+// Bidirectional upward Dijkstra from the cheapest of several sources;
+// returns the road path as dense indices and sets stats.distance (infinite
+// when unreachable)
+std::vector<int> ch_shortest_path(const std::vector<SearchSeed> &sources, int goal, SearchStats &stats)
+{
+    const auto &ch = contraction_hierarchy;
+    const int n = road_graph.num_nodes();
+    const double INF = std::numeric_limits<double>::max();
+    stats.distance = INF;
+
+    // aux holds the middle node of the shortcut that reached each node
+    SearchWorkspace &forward = thread_workspace(0);
+    SearchWorkspace &backward = thread_workspace(1);
+    forward.reset(n);
+    backward.reset(n);
+    auto &pq_forward = forward.queue;
+    auto &pq_backward = backward.queue;
+
+    for (const SearchSeed &seed : sources)
+    {
+        if (seed.cost >= forward.distance(seed.node))
+            continue;
+        forward.set(seed.node, seed.cost, -1);
+        pq_forward.push(seed.node, seed.cost);
+    }
+    backward.set(goal, 0.0, -1);
+    pq_backward.push(goal, 0.0);
+
+    double best = INF;
+    int meeting = -1;
+
+    // Settle the next node of one direction, following `offsets/targets/...`
+    auto step = [&](SearchWorkspace &self, const SearchWorkspace &other,
+                    const std::vector<int> &offsets, const std::vector<int> &targets,
+                    const std::vector<double> &weights, const std::vector<int> &middles)
+    {
+        int u = self.queue.pop();
+        double d = self.distance(u);
+        stats.settled++;
+
+        double other_d = other.distance(u);
+        if (other_d != INF && d + other_d < best)
+        {
+            best = d + other_d;
+            meeting = u;
+        }
+        for (int e = offsets[u]; e < offsets[u + 1]; e++)
+        {
+            int v = targets[e];
+            double nd = d + weights[e];
+            if (nd < self.distance(v))
+            {
+                self.set(v, nd, u, middles[e]);
+                self.queue.push(v, nd);
+            }
+        }
+    };
+
+    while (!pq_forward.empty() || !pq_backward.empty())
+    {
+        if (!pq_forward.empty() && pq_forward.top_key() >= best)
+            pq_forward.clear();
+        if (!pq_backward.empty() && pq_backward.top_key() >= best)
+            pq_backward.clear();
+
+        if (!pq_forward.empty())
+            step(forward, backward, ch.up_offsets, ch.up_targets, ch.up_weights, ch.up_middle);
+        if (!pq_backward.empty())
+            step(backward, forward, ch.down_offsets, ch.down_targets, ch.down_weights, ch.down_middle);
+    }
+
+    if (meeting == -1)
+        return {};
+
+    stats.distance = best;
+
+    std::vector<int> up_chain;
+    for (int v = meeting; forward.parent_of(v) != -1; v = forward.parent_of(v))
+        up_chain.push_back(v);
+    std::reverse(up_chain.begin(), up_chain.end());
+
+    int start = up_chain.empty() ? meeting : forward.parent_of(up_chain.front());
+    std::vector<int> path = {start};
+    int prev = start;
+    for (int v : up_chain)
+    {
+        ch_unpack_edge(prev, v, forward.aux_of(v), path);
+        prev = v;
+    }
+    for (int v = meeting; v != goal; v = backward.parent_of(v))
+        ch_unpack_edge(v, backward.parent_of(v), backward.aux_of(v), path);
+
+    return path;
+}
+
+std::vector<int> ch_shortest_path(int start, int goal, SearchStats &stats)
+{
+    return ch_shortest_path({{start, 0.0}}, goal, stats);
+}
+
+std::vector<long> ch_query(long start_node, long goal_node, SearchStats *stats = nullptr)
+{
+    int start = road_graph.index(start_node);
+    int goal = road_graph.index(goal_node);
+    if (start == -1 || goal == -1 || !contraction_hierarchy.ready())
+        return {};
+
+    SearchStats local;
+    std::vector<long> path;
+    for (int u : ch_shortest_path(start, goal, stats ? *stats : local))
+        path.push_back(road_graph.osm_ids[u]);
+    return path;
+}
+
+// ==================== MANY-TO-MANY DISTANCES (CH BUCKETS) ====================
+
+// Exhaustive upward search over the hierarchy. Scratch space comes from the
+// calling thread's workspace, so reset cost is proportional to the nodes
+// touched, not to the graph size; only the settled list is kept here.
+class UpwardSearch
+{
+public:
+    // Forward follows up_* edges, backward follows down_* edges. Returns every
+    // settled, non-stalled node with its distance from (or to) the source.
+    const std::vector<std::pair<int, double>> &run(int source, bool forward)
+    {
+        const auto &ch = contraction_hierarchy;
+        const auto &offsets = forward ? ch.up_offsets : ch.down_offsets;
+        const auto &targets = forward ? ch.up_targets : ch.down_targets;
+        const auto &weights = forward ? ch.up_weights : ch.down_weights;
+        // Edges of the opposite direction, used for stall-on-demand
+        const auto &stall_offsets = forward ? ch.down_offsets : ch.up_offsets;
+        const auto &stall_targets = forward ? ch.down_targets : ch.up_targets;
+        const auto &stall_weights = forward ? ch.down_weights : ch.up_weights;
+
+        SearchWorkspace &ws = thread_workspace();
+        ws.reset(road_graph.num_nodes());
+        settled.clear();
+
+        auto &pq = ws.queue;
+        ws.set(source, 0.0, -1);
+        pq.push(source, 0.0);
+
+        while (!pq.empty())
+        {
+            int u = pq.pop();
+            double d = ws.distance(u);
+
+            // A higher node already offers a shorter way here: u cannot lie on a shortest path
+            bool stalled = false;
+            for (int e = stall_offsets[u]; e < stall_offsets[u + 1] && !stalled; e++)
+            {
+                int w = stall_targets[e];
+                stalled = ws.visited(w) && ws.distance(w) + stall_weights[e] < d;
+            }
+            if (stalled)
+                continue;
+
+            settled.push_back({u, d});
+            for (int e = offsets[u]; e < offsets[u + 1]; e++)
+            {
+                int v = targets[e];
+                double nd = d + weights[e];
+                if (nd < ws.distance(v))
+                {
+                    ws.set(v, nd, u);
+                    pq.push(v, nd);
+                }
+            }
+        }
+        return settled;
+    }
+
+private:
+    std::vector<std::pair<int, double>> settled;
+};
+
+// Forward search spaces of every centre, grouped by the node they reach:
+// entries of node v are [offsets[v], offsets[v + 1]).
+struct CentreBuckets
+{
+    std::vector<int> offsets;
+    std::vector<int> centre_index;
+    std::vector<double> distance;
+    int num_centres = 0;
+
+    bool ready() const
+    {
+        return contraction_hierarchy.ready() && num_centres == (int)centres.size() &&
+               offsets.size() == (size_t)road_graph.num_nodes() + 1;
+    }
+
+    void clear()
+    {
+        offsets.clear();
+        centre_index.clear();
+        distance.clear();
+        num_centres = 0;
+    }
+};
+
+CentreBuckets centre_buckets;
+
+void build_centre_buckets()
+{
+    centre_buckets.clear();
+    if (!contraction_hierarchy.ready())
+        return;
+
+    const int n = road_graph.num_nodes();
+    struct BucketEntry
+    {
+        int node;
+        int centre;
+        double distance;
+    };
+    UpwardSearch search;
+    std::vector<BucketEntry> entries;
+
+    for (int c = 0; c < (int)centres.size(); c++)
+    {
+        int source = road_graph.index(centres[c].snapped_node_id);
+        if (source == -1)
+            continue;
+        for (const auto &[u, d] : search.run(source, true))
+            entries.push_back({u, c, d});
+    }
+
+    centre_buckets.offsets.assign(n + 1, 0);
+    for (const auto &entry : entries)
+        centre_buckets.offsets[entry.node + 1]++;
+    for (int v = 0; v < n; v++)
+        centre_buckets.offsets[v + 1] += centre_buckets.offsets[v];
+
+    centre_buckets.centre_index.resize(entries.size());
+    centre_buckets.distance.resize(entries.size());
+    std::vector<int> fill(centre_buckets.offsets.begin(), centre_buckets.offsets.end() - 1);
+    for (const auto &entry : entries)
+    {
+        int slot = fill[entry.node]++;
+        centre_buckets.centre_index[slot] = entry.centre;
+        centre_buckets.distance[slot] = entry.distance;
+    }
+    centre_buckets.num_centres = (int)centres.size();
+
+    std::cout << "Centre buckets: " << entries.size() << " entries for "
+              << centres.size() << " centres" << std::endl;
+}
+
+// Distances from every centre to target, one backward search plus bucket scans
+void centre_distances_to(int target, UpwardSearch &search, std::vector<double> &row)
+{
+    row.assign(centre_buckets.num_centres, std::numeric_limits<double>::max());
+    for (const auto &[v, d] : search.run(target, false))
+    {
+        for (int i = centre_buckets.offsets[v]; i < centre_buckets.offsets[v + 1]; i++)
+        {
+            double via = centre_buckets.distance[i] + d;
+            int c = centre_buckets.centre_index[i];
+            if (via < row[c])
+                row[c] = via;
+        }
+    }
+}
+
+// ==================== GRAPH SNAPSHOT ====================
+
+// Binary snapshot of everything /build-graph derives from the OSM data: CSR
+// arrays, coordinates, edge geometry, component ids, the KD-tree and the
+// contraction hierarchy. Layout: SnapshotHeader, SnapshotSection[section_count], then
+// the section payloads, each 8-byte aligned. Values are fixed-width and
+// native-endian; a snapshot with another version is rejected.
+const char SNAPSHOT_MAGIC[8] = {'R', 'F', 'G', 'R', 'A', 'P', 'H', '\0'};
+const uint32_t SNAPSHOT_VERSION = 3; // 2: edge geometry of contracted chains, 3: implicit KD-tree
+
+enum SnapshotTag : uint32_t
+{
+    SNAP_OFFSETS = 1,
+    SNAP_TARGETS,
+    SNAP_WEIGHTS,
+    SNAP_OSM_IDS,
+    SNAP_LAT,
+    SNAP_LON,
+    SNAP_COMPONENTS,
+    SNAP_KDTREE,
+    SNAP_CH_RANK,
+    SNAP_CH_UP_OFFSETS,
+    SNAP_CH_UP_TARGETS,
+    SNAP_CH_UP_WEIGHTS,
+    SNAP_CH_UP_MIDDLE,
+    SNAP_CH_DOWN_OFFSETS,
+    SNAP_CH_DOWN_TARGETS,
+    SNAP_CH_DOWN_WEIGHTS,
+    SNAP_CH_DOWN_MIDDLE,
+    SNAP_CH_COUNTS, // num_shortcuts, core_size
+    SNAP_SHAPE_OFFSETS,
+    SNAP_SHAPE_LAT,
+    SNAP_SHAPE_LON,
+};
+
+struct SnapshotHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t section_count;
+};
+
+struct SnapshotSection
+{
+    uint32_t tag;
+    uint32_t elem_size;
+    uint64_t offset;
+    uint64_t count;
+};
+
+// KD-tree entry (unit vector and road vertex), in the tree's implicit array order
+struct SnapshotKDPoint
+{
+    int64_t node_id;
+    double xyz[3];
+};
+
+class SnapshotWriter
+{
+public:
+    template <typename T>
+    void add(uint32_t tag, const std::vector<T> &values)
+    {
+        sections.push_back({tag, (uint32_t)sizeof(T), 0, values.size()});
+        payloads.push_back({values.data(), values.size() * sizeof(T)});
+    }
+
+    // Writes to path + ".tmp" and renames, so a crash never leaves a torn snapshot
+    bool write(const std::string &path)
+    {
+        SnapshotHeader header;
+        std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+        header.version = SNAPSHOT_VERSION;
+        header.section_count = (uint32_t)sections.size();
+
+        uint64_t offset = sizeof(SnapshotHeader) + sections.size() * sizeof(SnapshotSection);
+        for (size_t i = 0; i < sections.size(); i++)
+        {
+            offset = (offset + 7) / 8 * 8;
+            sections[i].offset = offset;
+            offset += payloads[i].second;
+        }
+
+        std::string tmp_path = path + ".tmp";
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!out.is_open())
+        {
+            std::cerr << "Failed to open " << tmp_path << std::endl;
+            return false;
+        }
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char *>(sections.data()), sections.size() * sizeof(SnapshotSection));
+        const char padding[8] = {0};
+        for (size_t i = 0; i < sections.size(); i++)
+        {
+            out.write(padding, sections[i].offset - (uint64_t)out.tellp());
+            out.write(static_cast<const char *>(payloads[i].first), payloads[i].second);
+        }
+        out.close();
+        if (!out)
+        {
+            std::cerr << "Failed to write " << tmp_path << std::endl;
+            return false;
+        }
+
+        std::remove(path.c_str());
+        if (std::rename(tmp_path.c_str(), path.c_str()) != 0)
+        {
+            std::cerr << "Failed to move snapshot to " << path << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+private:
+    std::vector<SnapshotSection> sections;
+    std::vector<std::pair<const void *, size_t>> payloads;
+};
+
+// Read-only memory mapping of a whole file
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    ~MappedFile() { close(); }
+
+    bool open(const std::string &path)
+    {
+        close();
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER file_size;
+        if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+            return false;
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping)
+            return false;
+        data = static_cast<const char *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        size = (size_t)file_size.QuadPart;
+#else
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0)
+            return false;
+        void *mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED)
+            return false;
+        data = static_cast<const char *>(mapped);
+        size = (size_t)st.st_size;
+#endif
+        return data != nullptr;
+    }
+
+    void close()
+    {
+#ifdef _WIN32
+        if (data)
+            UnmapViewOfFile(data);
+        if (mapping)
+            CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE)
+            CloseHandle(file);
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (data)
+            munmap(const_cast<char *>(data), size);
+        if (fd >= 0)
+            ::close(fd);
+        fd = -1;
+#endif
+        data = nullptr;
+        size = 0;
+    }
+
+    const char *data = nullptr;
+    size_t size = 0;
+
+private:
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+};
+
+// Section lookup over a mapped snapshot
+class SnapshotReader
+{
+public:
+    bool open(const std::string &path, std::string &error)
+    {
+        if (!file.open(path))
+        {
+            error = "cannot open " + path;
+            return false;
+        }
+        if (file.size < sizeof(SnapshotHeader))
+        {
+            error = "file too small";
+            return false;
+        }
+        std::memcpy(&header, file.data, sizeof(header));
+        if (std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0)
+        {
+            error = "not a graph snapshot";
+            return false;
+        }
+        if (header.version != SNAPSHOT_VERSION)
+        {
+            error = "snapshot version " + std::to_string(header.version) +
+                    ", expected " + std::to_string(SNAPSHOT_VERSION);
+            return false;
+        }
+        if (sizeof(SnapshotHeader) + (uint64_t)header.section_count * sizeof(SnapshotSection) > file.size)
+        {
+            error = "truncated section table";
+            return false;
+        }
+        sections.resize(header.section_count);
+        std::memcpy(sections.data(), file.data + sizeof(SnapshotHeader), sections.size() * sizeof(SnapshotSection));
+        return true;
+    }
+
+    bool has(uint32_t tag) const { return find(tag) != nullptr; }
+
+    // Copies a section out of the mapping; false if missing or malformed
+    template <typename T>
+    bool read(uint32_t tag, std::vector<T> &out, std::string &error) const
+    {
+        const SnapshotSection *section = find(tag);
+        if (!section || section->elem_size != sizeof(T) ||
+            section->offset + section->count * sizeof(T) > file.size)
+        {
+            error = "missing or malformed section " + std::to_string(tag);
+            return false;
+        }
+        out.resize(section->count);
+        if (section->count > 0)
+            std::memcpy(out.data(), file.data + section->offset, section->count * sizeof(T));
+        return true;
+    }
+
+private:
+    const SnapshotSection *find(uint32_t tag) const
+    {
+        for (const auto &section : sections)
+        {
+            if (section.tag == tag)
+                return &section;
+        }
+        return nullptr;
+    }
+
+    MappedFile file;
+    SnapshotHeader header;
+    std::vector<SnapshotSection> sections;
+};
+
+// Directory holding the snapshots requests may save and load. A server-side
+// setting (the GRAPH_SNAPSHOT_DIR environment variable); requests only name
+// a file inside it.
+std::string snapshot_server_dir = "snapshots";
+
+// Resolves a requested snapshot name to its path in snapshot_server_dir.
+// Only plain file names are accepted: no directories, no "." or "..".
+bool snapshot_file_path(const std::string &name, std::string &path)
+{
+    if (name.empty() || name == "." || name.find("..") != std::string::npos ||
+        name.find_first_of("/\\") != std::string::npos || name.find('\0') != std::string::npos)
+        return false;
+    path = (std::filesystem::path(snapshot_server_dir) / name).string();
+    return true;
+}
+
+bool save_graph_snapshot(const std::string &path)
+{
+    std::vector<int64_t> osm_ids(road_graph.osm_ids.begin(), road_graph.osm_ids.end());
+    std::vector<SnapshotKDPoint> kd_points;
+    kd_points.reserve(kdtree.size());
+    for (const KDTree::Entry &e : kdtree.ordered_entries())
+        kd_points.push_back({e.node_id, {e.xyz[0], e.xyz[1], e.xyz[2]}});
+
+    SnapshotWriter writer;
+    writer.add(SNAP_OFFSETS, road_graph.offsets);
+    writer.add(SNAP_TARGETS, road_graph.targets);
+    writer.add(SNAP_WEIGHTS, road_graph.weights);
+    writer.add(SNAP_OSM_IDS, osm_ids);
+    writer.add(SNAP_LAT, road_graph.lat);
+    writer.add(SNAP_LON, road_graph.lon);
+    writer.add(SNAP_COMPONENTS, node_component);
+    writer.add(SNAP_KDTREE, kd_points);
+    if (road_graph.has_geometry())
+    {
+        writer.add(SNAP_SHAPE_OFFSETS, road_graph.shape_offsets);
+        writer.add(SNAP_SHAPE_LAT, road_graph.shape_lat);
+        writer.add(SNAP_SHAPE_LON, road_graph.shape_lon);
+    }
+
+    const auto &ch = contraction_hierarchy;
+    std::vector<int64_t> ch_counts = {ch.num_shortcuts, ch.core_size};
+    if (ch.ready())
+    {
+        writer.add(SNAP_CH_RANK, ch.rank);
+        writer.add(SNAP_CH_UP_OFFSETS, ch.up_offsets);
+        writer.add(SNAP_CH_UP_TARGETS, ch.up_targets);
+        writer.add(SNAP_CH_UP_WEIGHTS, ch.up_weights);
+        writer.add(SNAP_CH_UP_MIDDLE, ch.up_middle);
+        writer.add(SNAP_CH_DOWN_OFFSETS, ch.down_offsets);
+        writer.add(SNAP_CH_DOWN_TARGETS, ch.down_targets);
+        writer.add(SNAP_CH_DOWN_WEIGHTS, ch.down_weights);
+        writer.add(SNAP_CH_DOWN_MIDDLE, ch.down_middle);
+        writer.add(SNAP_CH_COUNTS, ch_counts);
+    }
+
+    if (!writer.write(path))
+        return false;
+    std::cout << "💾 Graph snapshot written to " << path << std::endl;
+    return true;
+}
+
+// True if a CSR offsets array starts at 0, never decreases and ends at count
+bool valid_snapshot_offsets(const std::vector<int> &offsets, size_t count)
+{
+    if (offsets.empty() || offsets.front() != 0 || (size_t)offsets.back() != count)
+        return false;
+    for (size_t i = 1; i < offsets.size(); i++)
+        if (offsets[i] < offsets[i - 1])
+            return false;
+    return true;
+}
+
+// True if every value lies in [lo, hi)
+bool valid_snapshot_indices(const std::vector<int> &values, int lo, int hi)
+{
+    for (int v : values)
+        if (v < lo || v >= hi)
+            return false;
+    return true;
+}
+
+// Replaces the road graph, components, KD-tree and (if present) the
+// contraction hierarchy with the snapshot's. Global state is only touched
+// once the whole file has been read and validated.
+bool load_graph_snapshot(const std::string &path, std::string &error)
+{
+    SnapshotReader reader;
+    if (!reader.open(path, error))
+        return false;
+
+    RoadGraph loaded;
+    std::vector<int64_t> osm_ids;
+    std::vector<int> components;
+    std::vector<SnapshotKDPoint> kd_points;
+    if (!reader.read(SNAP_OFFSETS, loaded.offsets, error) ||
+        !reader.read(SNAP_TARGETS, loaded.targets, error) ||
+        !reader.read(SNAP_WEIGHTS, loaded.weights, error) ||
+        !reader.read(SNAP_OSM_IDS, osm_ids, error) ||
+        !reader.read(SNAP_LAT, loaded.lat, error) ||
+        !reader.read(SNAP_LON, loaded.lon, error) ||
+        !reader.read(SNAP_COMPONENTS, components, error) ||
+        !reader.read(SNAP_KDTREE, kd_points, error))
+        return false;
+
+    // Sizes, then every index the searches follow, so a damaged file cannot
+    // lead to out-of-bounds access after loading
+    size_t n = osm_ids.size();
+    if (n > (size_t)std::numeric_limits<int>::max() ||
+        loaded.offsets.size() != n + 1 || loaded.lat.size() != n || loaded.lon.size() != n ||
+        components.size() != n || loaded.targets.size() != loaded.weights.size() ||
+        !valid_snapshot_offsets(loaded.offsets, loaded.targets.size()) ||
+        !valid_snapshot_indices(loaded.targets, 0, (int)n))
+    {
+        error = "inconsistent graph arrays";
+        return false;
+    }
+    for (int comp : components)
+    {
+        if (comp != -1 && (comp < 1 || (size_t)comp > n))
+        {
+            error = "inconsistent component ids";
+            return false;
+        }
+    }
+
+    if (reader.has(SNAP_SHAPE_OFFSETS))
+    {
+        if (!reader.read(SNAP_SHAPE_OFFSETS, loaded.shape_offsets, error) ||
+            !reader.read(SNAP_SHAPE_LAT, loaded.shape_lat, error) ||
+            !reader.read(SNAP_SHAPE_LON, loaded.shape_lon, error))
+            return false;
+        if (loaded.shape_offsets.size() != loaded.targets.size() + 1 ||
+            loaded.shape_lat.size() != loaded.shape_lon.size() ||
+            !valid_snapshot_offsets(loaded.shape_offsets, loaded.shape_lat.size()))
+        {
+            error = "inconsistent geometry arrays";
+            return false;
+        }
+    }
+
+    ContractionHierarchy ch;
+    bool has_ch = reader.has(SNAP_CH_RANK);
+    if (has_ch)
+    {
+        std::vector<int64_t> ch_counts;
+        if (!reader.read(SNAP_CH_RANK, ch.rank, error) ||
+            !reader.read(SNAP_CH_UP_OFFSETS, ch.up_offsets, error) ||
+            !reader.read(SNAP_CH_UP_TARGETS, ch.up_targets, error) ||
+            !reader.read(SNAP_CH_UP_WEIGHTS, ch.up_weights, error) ||
+            !reader.read(SNAP_CH_UP_MIDDLE, ch.up_middle, error) ||
+            !reader.read(SNAP_CH_DOWN_OFFSETS, ch.down_offsets, error) ||
+            !reader.read(SNAP_CH_DOWN_TARGETS, ch.down_targets, error) ||
+            !reader.read(SNAP_CH_DOWN_WEIGHTS, ch.down_weights, error) ||
+            !reader.read(SNAP_CH_DOWN_MIDDLE, ch.down_middle, error) ||
+            !reader.read(SNAP_CH_COUNTS, ch_counts, error))
+            return false;
+        if (ch.rank.size() != n || ch.up_offsets.size() != n + 1 || ch.down_offsets.size() != n + 1 ||
+            ch_counts.size() != 2 ||
+            ch.up_weights.size() != ch.up_targets.size() || ch.up_middle.size() != ch.up_targets.size() ||
+            ch.down_weights.size() != ch.down_targets.size() || ch.down_middle.size() != ch.down_targets.size() ||
+            !valid_snapshot_offsets(ch.up_offsets, ch.up_targets.size()) ||
+            !valid_snapshot_offsets(ch.down_offsets, ch.down_targets.size()) ||
+            !valid_snapshot_indices(ch.up_targets, 0, (int)n) ||
+            !valid_snapshot_indices(ch.down_targets, 0, (int)n) ||
+            !valid_snapshot_indices(ch.up_middle, -1, (int)n) ||
+            !valid_snapshot_indices(ch.down_middle, -1, (int)n))
+        {
+            error = "inconsistent hierarchy arrays";
+            return false;
+        }
+        ch.num_shortcuts = (int)ch_counts[0];
+        ch.core_size = (int)ch_counts[1];
+    }
+
+    loaded.osm_ids.assign(osm_ids.begin(), osm_ids.end());
+    loaded.index_of.reserve(n);
+    for (size_t u = 0; u < n; u++)
+        loaded.index_of[loaded.osm_ids[u]] = (int)u;
+    index_in_edges(loaded);
+
+    graph.clear();
+    nodes.clear();
+    road_graph = std::move(loaded);
+    node_component = std::move(components);
+    count_component_sizes();
+    std::vector<KDTree::Entry> ordered;
+    ordered.reserve(kd_points.size());
+    for (const SnapshotKDPoint &p : kd_points)
+        ordered.push_back({{p.xyz[0], p.xyz[1], p.xyz[2]}, (long)p.node_id});
+    kdtree.assign(std::move(ordered));
+    tag_kdtree_components();
+    segment_index.build(road_segments());
+    contraction_hierarchy = std::move(ch);
+    centre_buckets.clear();
+    allotment_matrix.clear();
+
+    std::cout << "📂 Graph snapshot loaded from " << path << ": " << road_graph.num_nodes()
+              << " nodes, " << road_graph.num_edges() << " edges"
+              << (has_ch ? ", with contraction hierarchy" : "") << std::endl;
+    return true;
+}
+
+// ==================== ALLOTMENT LOOKUP ====================
+
+// Rows of allotment_matrix for a batch, sorted. A student's row_key is its
+// snapped node, or, for a student snapped onto a road segment, -2 - (its
+// index in the batch): that row is derived from the rows of the segment's
+// two ends by fill_edge_snap_rows(), so both ends get a row as well.
+std::vector<long> student_matrix_rows(const std::vector<Student> &batch)
+{
+    std::vector<long> keys;
+    for (const auto &student : batch)
+    {
+        if (student.row_key < -1)
+        {
+            keys.push_back(student.row_key);
+            keys.push_back(student.edge_snap.start_node);
+            keys.push_back(student.edge_snap.end_node);
+        }
+        else if (student.row_key != -1 && road_graph.index(student.row_key) != -1)
+        {
+            keys.push_back(student.row_key);
+        }
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    return keys;
+}
+
+// Travel times to students snapped onto a road segment: the search is seeded
+// from both ends, arriving at the projection from whichever end is quicker
+// (and allowed by one-way restrictions)
+void fill_edge_snap_rows(const std::vector<Student> &batch)
 {
-    std::unordered_map<long, double> distances;
-    std::unordered_map<long, long> parents;
-    std::priority_queue<std::pair<double, long>,
-                        std::vector<std::pair<double, long>>,
-                        std::greater<std::pair<double, long>>>
-        pq;
-
-    for (const auto &[node_id, _] : nodes)
+    const float INF = std::numeric_limits<float>::infinity();
+    for (const auto &student : batch)
     {
-        distances[node_id] = std::numeric_limits<double>::max();
-        parents[node_id] = -1;
+        if (student.row_key >= -1)
+            continue;
+        const EdgeSnap &snap = student.edge_snap;
+        float *distances = allotment_matrix.row(allotment_matrix.row_of(student.row_key));
+        const float *via_start = allotment_matrix.row(allotment_matrix.row_of(snap.start_node));
+        const float *via_end = allotment_matrix.row(allotment_matrix.row_of(snap.end_node));
+        bool from_start = snap.seconds_from_start != std::numeric_limits<double>::max();
+        bool from_end = snap.seconds_from_end != std::numeric_limits<double>::max();
+        for (size_t c = 0; c < centres.size(); c++)
+        {
+            float best = INF;
+            if (from_start && via_start[c] != INF)
+                best = std::min(best, via_start[c] + (float)snap.seconds_from_start);
+            if (from_end && via_end[c] != INF)
+                best = std::min(best, via_end[c] + (float)snap.seconds_from_end);
+            distances[c] = best;
+        }
     }
-    distances[start_node] = 0.0;
-    parents[start_node] = start_node;
+}
 
-    pq.push({0.0, start_node});
+// Fill allotment_matrix with one full Dijkstra per centre. The searches run
+// on the worker pool and each writes only its own column, so nothing is locked.
+// With integer_weights the searches run on 0.1 s ticks (dijkstra_ticks); the
+// return value then bounds how far any matrix entry may undershoot the true
+// travel time, and is 0 otherwise
+double build_full_lookup(const std::vector<Student> &batch, bool integer_weights)
+{
+    allotment_matrix.reset(student_matrix_rows(batch), centres.size());
 
-    while (!pq.empty())
+    // Node rows only; edge-snap rows (negative keys) are derived afterwards
+    std::vector<int> row_index;
+    std::vector<int> node_rows;
+    for (int r = 0; r < allotment_matrix.num_rows(); r++)
     {
-        auto [current_dist, current_node] = pq.top();
-        pq.pop();
-
-        if (current_dist > distances[current_node])
+        if (allotment_matrix.row_nodes[r] < 0)
             continue;
+        node_rows.push_back(r);
+        row_index.push_back(road_graph.index(allotment_matrix.row_nodes[r]));
+    }
 
-        if (graph.find(current_node) != graph.end())
+    int workers = worker_count(centres.size());
+    std::cout << "Running Dijkstra from " << centres.size() << " centres on "
+              << workers << " threads..." << std::endl;
+
+    std::vector<double> error_bound(centres.size(), 0.0);
+    parallel_for(centres.size(), workers, [&](size_t c, int)
+                 {
+        SearchWorkspace &ws = thread_workspace();
+        if (integer_weights)
+            dijkstra_ticks(centres[c].snapped_node_id, ws);
+        else
+            dijkstra(centres[c].snapped_node_id, ws);
+        for (size_t i = 0; i < node_rows.size(); i++)
         {
-            for (const auto &[neighbor, edge_weight] : graph[current_node])
+            double d = ws.distance(row_index[i]);
+            if (d != std::numeric_limits<double>::max())
             {
-                double new_dist = current_dist + edge_weight;
-
-                if (new_dist < distances[neighbor])
-                {
-                    distances[neighbor] = new_dist;
-                    parents[neighbor] = current_node;
-                    pq.push({new_dist, neighbor});
-                }
+                allotment_matrix.row(node_rows[i])[c] = (float)d;
+                if (integer_weights)
+                    error_bound[c] = std::max(error_bound[c], ticks_error_bound(ws, row_index[i]));
             }
-        }
-    }
+        } });
+    fill_edge_snap_rows(batch);
 
-    return {distances, parents};
+    std::cout << "Distance matrix: " << allotment_matrix.num_rows() << " student nodes x "
+              << centres.size() << " centres (" << allotment_matrix.bytes() / 1024 << " KB)" << std::endl;
+    return error_bound.empty() ? 0.0 : *std::max_element(error_bound.begin(), error_bound.end());
 }
 
-// Function to run Dijkstra for a single centre (used in parallel execution)
-DijkstraResult run_dijkstra_for_centre(const Centre &centre)
+// With a contraction hierarchy the centre buckets are prepared here; the
+// matrix itself is filled per batch in /run-allotment once students are snapped.
+void build_allotment_lookup()
 {
-    DijkstraResult result;
-    result.centre_id = centre.centre_id;
-    result.start_node = centre.snapped_node_id;
-    result.success = false;
+    std::cout << "Building allotment lookup..." << std::endl;
 
-    try
-    {
-        auto start_time = std::chrono::high_resolution_clock::now();
+    allotment_matrix.clear();
 
-        auto [distances, parents] = dijkstra_with_parents(centre.snapped_node_id);
+    build_centre_buckets();
+    if (centre_buckets.ready())
+    {
+        std::cout << "Allotment lookup prepared (many-to-many buckets)" << std::endl;
+        return;
+    }
 
-        auto end_time = std::chrono::high_resolution_clock::now();
-        result.computation_time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
-                                         end_time - start_time)
-                                         .count();
+    std::cout << "No hierarchy: centre distances will be computed per batch with Dijkstra" << std::endl;
+}
 
-        result.distances = std::move(distances);
-        result.parents = std::move(parents);
-        result.success = true;
+// Cost model for /run-allotment: one backward search (about the size of an
+// average centre search space) per distinct student node, versus one full
+// Dijkstra per centre
+bool many_to_many_is_cheaper(const std::vector<Student> &batch)
+{
+    if (!centre_buckets.ready() || centres.empty())
+        return false;
 
-        std::cout << "✓ Completed Dijkstra for " << centre.centre_id
-                  << " in " << result.computation_time_ms << "ms" << std::endl;
-    }
-    catch (const std::exception &e)
-    {
-        result.error_message = e.what();
-        std::cerr << "✗ Error in Dijkstra for " << centre.centre_id
-                  << ": " << e.what() << std::endl;
-    }
+    std::vector<long> keys = student_matrix_rows(batch);
+    size_t distinct = keys.end() - std::lower_bound(keys.begin(), keys.end(), 0L);
 
-    return result;
+    double avg_search_space = (double)centre_buckets.centre_index.size() / centres.size();
+    return distinct * avg_search_space < (double)centres.size() * road_graph.num_nodes();
 }
 
-// Save Dijkstra results to JSON files
-bool save_dijkstra_results(const DijkstraResult &result,
-                           const std::string &distances_file,
-                           const std::string &parents_file)
+// Fill allotment_matrix with one backward search per distinct student node,
+// spread over the worker pool with per-worker search state; each task writes
+// only its own row
+void build_student_lookup(const std::vector<Student> &batch)
 {
-    try
-    {
-        // Save distances
-        json distances_json = json::object();
-        for (const auto &[node_id, dist] : result.distances)
+    allotment_matrix.reset(student_matrix_rows(batch), centres.size());
+
+    // Node rows follow the negative edge-snap keys, which are derived afterwards
+    const std::vector<long> &keys = allotment_matrix.row_nodes;
+    int first_node_row = (int)(std::lower_bound(keys.begin(), keys.end(), 0L) - keys.begin());
+    int node_rows = allotment_matrix.num_rows() - first_node_row;
+    int workers = worker_count(node_rows);
+    std::vector<UpwardSearch> searches(workers);
+    std::vector<std::vector<double>> rows(workers);
+    parallel_for(node_rows, workers, [&](size_t i, int worker)
+                 {
+        int r = first_node_row + (int)i;
+        int target = road_graph.index(allotment_matrix.row_nodes[r]);
+        centre_distances_to(target, searches[worker], rows[worker]);
+        float *distances = allotment_matrix.row(r);
+        for (int c = 0; c < (int)centres.size(); c++)
         {
-            if (dist != std::numeric_limits<double>::max())
-            {
-                distances_json[std::to_string(node_id)] = dist;
-            }
-        }
+            if (rows[worker][c] != std::numeric_limits<double>::max())
+                distances[c] = (float)rows[worker][c];
+        } });
+    fill_edge_snap_rows(batch);
 
-        std::ofstream dist_out(distances_file);
-        if (!dist_out.is_open())
-        {
-            std::cerr << "Failed to open " << distances_file << std::endl;
-            return false;
-        }
-        dist_out << distances_json.dump(2);
-        dist_out.close();
+    std::cout << "Many-to-many table: " << allotment_matrix.num_rows() << " student nodes x "
+              << centres.size() << " centres (" << allotment_matrix.bytes() / 1024 << " KB)" << std::endl;
+}
 
-        // Save parents
-        json parents_json = json::object();
-        for (const auto &[node_id, parent] : result.parents)
-        {
-            if (parent != -1)
-            {
-                parents_json[std::to_string(node_id)] = parent;
-            }
-        }
+// ==================== DISTANCE-FIRST PRIORITY QUEUE ALLOTMENT ====================
 
-        std::ofstream parent_out(parents_file);
-        if (!parent_out.is_open())
-        {
-            std::cerr << "Failed to open " << parents_file << std::endl;
-            return false;
-        }
-        parent_out << parents_json.dump(2);
-        parent_out.close();
+// HELPER: Check if a student-centre assignment is valid
+bool is_valid_assignment(const Student &student, const Centre &centre)
+{
+    // All constraints removed as per new logic.
+    // All centres are identical and accept all student categories.
+    return true;
+}
 
-        std::cout << "✓ Saved results for " << result.centre_id << std::endl;
-        std::cout << "  - Distances: " << distances_file << std::endl;
-        std::cout << "  - Parents: " << parents_file << std::endl;
+struct GreedyStats
+{
+    int candidate_k = 0;      // 0 = exhaustive
+    size_t peak_entries = 0;  // largest queue (+ candidate slots) held at once
+    long long widenings = 0;  // top-K refills beyond the first K
+};
 
-        return true;
-    }
-    catch (const std::exception &e)
+// Student indices per tier, in allotment priority order: male, PwD, female
+std::array<std::vector<int>, 3> students_by_tier()
+{
+    std::array<std::vector<int>, 3> tiers;
+    for (int s = 0; s < (int)students.size(); s++)
     {
-        std::cerr << "Error saving results: " << e.what() << std::endl;
-        return false;
+        const auto &category = students[s].category;
+        if (category == "female")
+            tiers[2].push_back(s);
+        else if (category == "pwd")
+            tiers[1].push_back(s);
+        else
+            tiers[0].push_back(s);
     }
+    return tiers;
 }
 
-// ==================== A* ALGORITHM ====================
-
-std::vector<long> a_star(long start_node, long goal_node)
+// Total travel time (seconds) of final_assignments, the objective both
+// allotment engines are compared on
+double assignment_objective()
 {
-    std::unordered_map<long, double> g_score;
-    std::unordered_map<long, double> f_score;
-    std::unordered_map<long, long> came_from;
-
-    auto compare = [&f_score](long a, long b)
-    { return f_score[a] > f_score[b]; };
-    std::priority_queue<long, std::vector<long>, decltype(compare)> open_set(compare);
-    std::set<long> open_set_tracker;
+    std::unordered_map<std::string, int> centre_index;
+    for (int c = 0; c < (int)centres.size(); c++)
+        centre_index[centres[c].centre_id] = c;
 
-    for (const auto &[node_id, _] : nodes)
+    double total = 0;
+    for (const auto &student : students)
     {
-        g_score[node_id] = std::numeric_limits<double>::max();
-        f_score[node_id] = std::numeric_limits<double>::max();
+        auto it = final_assignments.find(student.student_id);
+        if (it == final_assignments.end())
+            continue;
+        double d = allotment_matrix.distance(student.row_key, centre_index[it->second]);
+        if (d != std::numeric_limits<double>::max())
+            total += d;
     }
+    return total;
+}
 
-    g_score[start_node] = 0.0;
-    f_score[start_node] = heuristic(start_node, goal_node);
+using AssignmentQueue = std::priority_queue<AssignmentPair, std::vector<AssignmentPair>, std::greater<AssignmentPair>>;
 
-    open_set.push(start_node);
-    open_set_tracker.insert(start_node);
+// HELPER: Queue every reachable (student, centre) pair of a tier, reading
+// each student's contiguous row of allotment_matrix. Returns how many of the
+// tier's students have at least one candidate.
+int fill_priority_queue(const std::vector<int> &tier_students, AssignmentQueue &pq)
+{
+    std::vector<AssignmentPair> storage;
+    storage.reserve(tier_students.size() * centres.size());
+    pq = AssignmentQueue(std::greater<AssignmentPair>(), std::move(storage));
 
-    while (!open_set.empty())
+    int with_candidates = 0;
+    for (int s : tier_students)
     {
-        long current = open_set.top();
-        open_set.pop();
-        open_set_tracker.erase(current);
-
-        if (current == goal_node)
-        {
-            std::vector<long> path;
-            long node = goal_node;
-            while (came_from.find(node) != came_from.end())
-            {
-                path.push_back(node);
-                node = came_from[node];
-            }
-            path.push_back(start_node);
-            std::reverse(path.begin(), path.end());
-            return path;
-        }
-
-        if (graph.find(current) != graph.end())
+        const Student &student = students[s];
+        int r = allotment_matrix.row_of(student.row_key);
+        if (r == -1)
+            continue;
+        const float *centre_distances = allotment_matrix.row(r);
+        bool any = false;
+        for (int c = 0; c < (int)centres.size(); c++)
         {
-            for (const auto &[neighbor, edge_weight] : graph[current])
+            if (is_valid_assignment(student, centres[c]) && std::isfinite(centre_distances[c]))
             {
-                double tentative_g_score = g_score[current] + edge_weight;
-
-                if (tentative_g_score < g_score[neighbor])
-                {
-                    came_from[neighbor] = current;
-                    g_score[neighbor] = tentative_g_score;
-                    f_score[neighbor] = g_score[neighbor] + heuristic(neighbor, goal_node);
-
-                    if (open_set_tracker.find(neighbor) == open_set_tracker.end())
-                    {
-                        open_set.push(neighbor);
-                        open_set_tracker.insert(neighbor);
-                    }
-                }
+                pq.push({centre_distances[c], s, c});
+                any = true;
             }
         }
+        with_candidates += any;
     }
-
-    return {};
+    return with_candidates;
 }
 
-// ==================== ALLOTMENT LOOKUP ====================
-
-void build_allotment_lookup()
+// HELPER: Process a single priority queue batch (Distance-First). Stops
+// early once every candidate student is placed or every seat is taken.
+void process_priority_queue(
+    AssignmentQueue &pq,
+    int students_to_place,
+    std::vector<bool> &assigned_students,
+    std::vector<int> &centre_loads,
+    int &free_seats)
 {
-    std::cout << "Building allotment lookup map..." << std::endl;
-
-    allotment_lookup_map.clear();
-
-    for (const auto &centre : centres)
+    while (!pq.empty() && students_to_place > 0 && free_seats > 0)
     {
-        std::cout << "Running Dijkstra from centre: " << centre.centre_id << std::endl;
+        auto assignment = pq.top();
+        pq.pop();
 
-        auto distances = dijkstra(centre.snapped_node_id);
+        // Check if student already assigned
+        if (assigned_students[assignment.student])
+        {
+            continue;
+        }
 
-        for (const auto &[node_id, dist] : distances)
+        // Check if this centre is full
+        Centre &target_centre = centres[assignment.centre];
+        if (centre_loads[assignment.centre] >= target_centre.max_capacity)
         {
-            allotment_lookup_map[node_id][centre.centre_id] = dist;
+            continue;
         }
-    }
 
-    std::cout << "Allotment lookup map built successfully!" << std::endl;
+        // Make assignment
+        final_assignments[students[assignment.student].student_id] = target_centre.centre_id;
+        assigned_students[assignment.student] = true;
+        centre_loads[assignment.centre]++;
+        target_centre.current_load = centre_loads[assignment.centre];
+        students_to_place--;
+        free_seats--;
+    }
 }
 
-// ==================== DISTANCE-FIRST PRIORITY QUEUE ALLOTMENT ====================
+// Sparse candidates for one tier: each student holds only its next K centres
+// in (distance, centre) order, refilled from its matrix row once used up.
+struct TierCandidates
+{
+    int k = 0;
+    std::vector<int> centre;    // k slots per tier student
+    std::vector<float> distance;
+    std::vector<int> count;     // filled slots per tier student
+    std::vector<int> cursor;    // next unused slot per tier student
+    std::vector<int> row;       // allotment_matrix row, -1 if none
+    long long widenings = 0;    // refills after the first K
+};
 
-// HELPER: Check if a student-centre assignment is valid
-bool is_valid_assignment(const Student &student, const Centre &centre)
+// HELPER: Fill slot block i with the K valid centres that come right after
+// (after_distance, after_centre) in the student's row. Returns false if none are left.
+bool refill_candidates(TierCandidates &cands, int i, const Student &student,
+                       float after_distance, int after_centre)
 {
-    // All constraints removed as per new logic.
-    // All centres are identical and accept all student categories.
-    return true;
+    const float *centre_distances = allotment_matrix.row(cands.row[i]);
+    std::vector<std::pair<float, int>> next;
+    for (int c = 0; c < (int)centres.size(); c++)
+    {
+        float d = centre_distances[c];
+        if (!std::isfinite(d) || !is_valid_assignment(student, centres[c]))
+            continue;
+        if (d < after_distance || (d == after_distance && c <= after_centre))
+            continue;
+        next.push_back({d, c});
+    }
+
+    size_t take = std::min<size_t>(cands.k, next.size());
+    std::partial_sort(next.begin(), next.begin() + take, next.end());
+    for (size_t j = 0; j < take; j++)
+    {
+        cands.distance[(size_t)i * cands.k + j] = next[j].first;
+        cands.centre[(size_t)i * cands.k + j] = next[j].second;
+    }
+    cands.count[i] = (int)take;
+    cands.cursor[i] = 0;
+    return take > 0;
 }
 
-// HELPER: Process a single priority queue batch (Distance-First)
-void process_priority_queue(
-    std::priority_queue<AssignmentPair, std::vector<AssignmentPair>, std::greater<AssignmentPair>> &pq,
-    std::set<std::string> &assigned_students,
-    std::unordered_map<std::string, int> &centre_loads)
+// HELPER: Sparse version of fill_priority_queue + process_priority_queue.
+// The queue holds one entry per unplaced student: its best untried centre.
+// When that centre is full the student's next candidate is pushed, so pairs
+// are still tried in the same global order as the exhaustive queue and the
+// assignments are identical; memory is O(tier size x K).
+void process_tier_top_k(
+    const std::vector<int> &tier_students,
+    int k,
+    std::vector<bool> &assigned_students,
+    std::vector<int> &centre_loads,
+    int &free_seats,
+    long long &widenings,
+    size_t &peak_entries)
 {
-    while (!pq.empty())
+    TierCandidates cands;
+    cands.k = k;
+    cands.centre.resize(tier_students.size() * k);
+    cands.distance.resize(tier_students.size() * k);
+    cands.count.assign(tier_students.size(), 0);
+    cands.cursor.assign(tier_students.size(), 0);
+    cands.row.assign(tier_students.size(), -1);
+
+    std::vector<AssignmentPair> storage;
+    storage.reserve(tier_students.size());
+    AssignmentQueue pq(std::greater<AssignmentPair>(), std::move(storage));
+
+    std::vector<int> tier_pos(students.size(), -1);
+    int students_to_place = 0;
+    for (int i = 0; i < (int)tier_students.size(); i++)
+    {
+        const Student &student = students[tier_students[i]];
+        tier_pos[tier_students[i]] = i;
+        cands.row[i] = allotment_matrix.row_of(student.row_key);
+        if (cands.row[i] == -1)
+            continue;
+        if (refill_candidates(cands, i, student, -std::numeric_limits<float>::infinity(), -1))
+        {
+            pq.push({cands.distance[(size_t)i * k], tier_students[i], cands.centre[(size_t)i * k]});
+            students_to_place++;
+        }
+    }
+    peak_entries = std::max(peak_entries, cands.centre.size() + pq.size());
+
+    while (!pq.empty() && students_to_place > 0 && free_seats > 0)
     {
         auto assignment = pq.top();
         pq.pop();
 
-        // Check if student already assigned
-        if (assigned_students.find(assignment.student_id) != assigned_students.end())
+        Centre &target_centre = centres[assignment.centre];
+        if (centre_loads[assignment.centre] < target_centre.max_capacity)
         {
+            final_assignments[students[assignment.student].student_id] = target_centre.centre_id;
+            assigned_students[assignment.student] = true;
+            centre_loads[assignment.centre]++;
+            target_centre.current_load = centre_loads[assignment.centre];
+            students_to_place--;
+            free_seats--;
             continue;
         }
 
-        // Find centre and check capacity
-        Centre *target_centre = nullptr;
-        for (auto &centre : centres)
+        // Centre full: move on to the student's next candidate, widening past K if needed
+        int i = tier_pos[assignment.student];
+        if (++cands.cursor[i] == cands.count[i])
         {
-            if (centre.centre_id == assignment.centre_id)
+            if (!refill_candidates(cands, i, students[assignment.student],
+                                   (float)assignment.distance, assignment.centre))
             {
-                target_centre = &centre;
-                break;
+                students_to_place--;
+                continue;
             }
+            cands.widenings++;
         }
-        if (target_centre == nullptr)
-            continue;
-
-        // Check if this centre is full
-        if (centre_loads[assignment.centre_id] >= target_centre->max_capacity)
-        {
-            continue;
-        }
-
-        // Make assignment
-        final_assignments[assignment.student_id] = assignment.centre_id;
-        assigned_students.insert(assignment.student_id);
-        centre_loads[assignment.centre_id]++;
-        target_centre->current_load = centre_loads[assignment.centre_id];
+        size_t slot = (size_t)i * k + cands.cursor[i];
+        pq.push({cands.distance[slot], assignment.student, cands.centre[slot]});
     }
+
+    widenings += cands.widenings;
 }
 
-// NEW: Distance-First Tiered Allotment Algorithm
-void run_batch_greedy_allotment()
+// NEW: Distance-First Tiered Allotment Algorithm. candidate_k = 0 queues every
+// reachable pair; candidate_k > 0 keeps only the K nearest centres per student
+// (widening on demand) and yields the same assignments.
+GreedyStats run_batch_greedy_allotment(int candidate_k)
 {
     std::cout << "\n🎯 Running TIERED DISTANCE-FIRST Allotment..." << std::endl;
 
     auto start = std::chrono::high_resolution_clock::now();
 
-    std::set<std::string> assigned_students;
-    std::unordered_map<std::string, int> centre_loads;
+    std::vector<bool> assigned_students(students.size(), false);
+    std::vector<int> centre_loads(centres.size(), 0);
+    int free_seats = 0;
     for (auto &centre : centres)
     {
-        centre_loads[centre.centre_id] = 0;
         centre.current_load = 0;
+        free_seats += std::max(0, centre.max_capacity);
     }
 
     final_assignments.clear();
 
     // Separate students into batches (Male > PwD > Female priority based on commented code)
-    std::vector<Student> female_students, pwd_students, male_students;
-    for (const auto &student : students)
-    {
-        if (student.category == "female")
-            female_students.push_back(student);
-        else if (student.category == "pwd")
-            pwd_students.push_back(student);
-        else
-            male_students.push_back(student);
-    }
+    auto tiers = students_by_tier();
+    const auto &male_students = tiers[0];
+    const auto &pwd_students = tiers[1];
+    const auto &female_students = tiers[2];
 
     std::cout << "📊 Distribution: Female=" << female_students.size()
               << " | PwD=" << pwd_students.size()
               << " | Male=" << male_students.size() << std::endl;
 
+    GreedyStats stats;
+    stats.candidate_k = candidate_k;
+    AssignmentQueue pq;
+    size_t assigned_count = 0;
+    auto run_tier = [&](const std::vector<int> &tier_students)
+    {
+        int free_before = free_seats;
+        if (candidate_k > 0)
+        {
+            process_tier_top_k(tier_students, candidate_k, assigned_students, centre_loads,
+                               free_seats, stats.widenings, stats.peak_entries);
+        }
+        else
+        {
+            int to_place = fill_priority_queue(tier_students, pq);
+            stats.peak_entries = std::max(stats.peak_entries, pq.size());
+            process_priority_queue(pq, to_place, assigned_students, centre_loads, free_seats);
+        }
+        assigned_count += free_before - free_seats;
+        return free_before - free_seats;
+    };
+
     // --- TIER 1: MALE (based on current priority) ---
     std::cout << "\n🟢 BATCH 1: Processing " << male_students.size() << " Male students..." << std::endl;
-    std::priority_queue<AssignmentPair, std::vector<AssignmentPair>, std::greater<AssignmentPair>> pq_male;
-    for (const auto &student : male_students)
+    std::cout << "✅ Assigned " << run_tier(male_students) << " male students" << std::endl;
+
+    // --- TIER 2: PWD ---
+    std::cout << "\n🔵 BATCH 2: Processing " << pwd_students.size() << " PwD students..." << std::endl;
+    std::cout << "✅ Assigned " << run_tier(pwd_students) << " PwD students" << std::endl;
+
+    // --- TIER 3: FEMALE ---
+    std::cout << "\n🟣 BATCH 3: Processing " << female_students.size() << " Female students..." << std::endl;
+    std::cout << "✅ Assigned " << run_tier(female_students) << " female students" << std::endl;
+
+    auto end = std::chrono::high_resolution_clock::now();
+    long long total_ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+
+    std::cout << "\n🎉 TIERED ALLOTMENT COMPLETE! Total Assigned: " << assigned_count
+              << " / " << students.size() << " students in " << total_ms << "ms"
+              << " (peak queue/candidate entries: " << stats.peak_entries;
+    if (candidate_k > 0)
+        std::cout << ", widenings: " << stats.widenings;
+    std::cout << ")" << std::endl;
+
+    return stats;
+}
+
+// ==================== MIN-COST FLOW ALLOTMENT ====================
+
+// Successive shortest paths with Johnson potentials. All input costs are
+// non-negative, so the first search needs no Bellman-Ford.
+class MinCostFlow
+{
+public:
+    explicit MinCostFlow(int n) : graph(n) {}
+
+    // Returns an id for flow_on()
+    int add_edge(int from, int to, int capacity, double cost)
     {
-        if (allotment_lookup_map.find(student.snapped_node_id) == allotment_lookup_map.end())
-            continue;
-        const auto &centre_distances = allotment_lookup_map[student.snapped_node_id];
-        for (const auto &centre : centres)
+        graph[from].push_back({to, (int)graph[to].size(), capacity, cost});
+        graph[to].push_back({from, (int)graph[from].size() - 1, 0, -cost});
+        edge_pos.push_back({from, (int)graph[from].size() - 1});
+        return (int)edge_pos.size() - 1;
+    }
+
+    int flow_on(int id) const
+    {
+        const Edge &e = graph[edge_pos[id].first][edge_pos[id].second];
+        return graph[e.to][e.rev].capacity;
+    }
+
+    // Sends as much flow as possible from s to t at minimum cost
+    std::pair<int, double> solve(int s, int t)
+    {
+        const double INF = std::numeric_limits<double>::max();
+        int n = (int)graph.size();
+        std::vector<double> potential(n, 0.0), dist(n);
+        std::vector<int> prev_node(n), prev_edge(n);
+        int total_flow = 0;
+        double total_cost = 0;
+
+        while (true)
         {
-            if (is_valid_assignment(student, centre))
+            std::fill(dist.begin(), dist.end(), INF);
+            std::priority_queue<std::pair<double, int>,
+                                std::vector<std::pair<double, int>>,
+                                std::greater<std::pair<double, int>>>
+                pq;
+            dist[s] = 0;
+            pq.push({0.0, s});
+            while (!pq.empty())
             {
-                auto it = centre_distances.find(centre.centre_id);
-                if (it != centre_distances.end() && it->second != std::numeric_limits<double>::max())
+                auto [d, u] = pq.top();
+                pq.pop();
+                if (d > dist[u])
+                    continue;
+                if (u == t)
+                    break;
+                for (int i = 0; i < (int)graph[u].size(); i++)
                 {
-                    pq_male.push({it->second, student.student_id, centre.centre_id});
+                    const Edge &e = graph[u][i];
+                    if (e.capacity <= 0)
+                        continue;
+                    // Reduced costs are >= 0 up to rounding
+                    double nd = d + std::max(0.0, e.cost + potential[u] - potential[e.to]);
+                    if (nd < dist[e.to])
+                    {
+                        dist[e.to] = nd;
+                        prev_node[e.to] = u;
+                        prev_edge[e.to] = i;
+                        pq.push({nd, e.to});
+                    }
                 }
             }
+            if (dist[t] == INF)
+                break;
+
+            // Nodes not settled before t keep reduced costs valid with dist[t]
+            for (int v = 0; v < n; v++)
+                potential[v] += std::min(dist[v], dist[t]);
+
+            int push = std::numeric_limits<int>::max();
+            for (int v = t; v != s; v = prev_node[v])
+                push = std::min(push, graph[prev_node[v]][prev_edge[v]].capacity);
+            for (int v = t; v != s; v = prev_node[v])
+            {
+                Edge &e = graph[prev_node[v]][prev_edge[v]];
+                e.capacity -= push;
+                graph[v][e.rev].capacity += push;
+                total_cost += push * e.cost;
+            }
+            total_flow += push;
+            augmentations++;
         }
+        return {total_flow, total_cost};
     }
-    process_priority_queue(pq_male, assigned_students, centre_loads);
-    std::cout << "✅ Assigned " << assigned_students.size() << " male students" << std::endl;
 
-    // --- TIER 2: PWD ---
-    std::cout << "\n🔵 BATCH 2: Processing " << pwd_students.size() << " PwD students..." << std::endl;
-    std::priority_queue<AssignmentPair, std::vector<AssignmentPair>, std::greater<AssignmentPair>> pq_pwd;
-    for (const auto &student : pwd_students)
+    long long augmentations = 0;
+
+private:
+    struct Edge
     {
-        if (allotment_lookup_map.find(student.snapped_node_id) == allotment_lookup_map.end())
-            continue;
-        const auto &centre_distances = allotment_lookup_map[student.snapped_node_id];
-        for (const auto &centre : centres)
+        int to;
+        int rev;
+        int capacity;
+        double cost;
+    };
+    std::vector<std::vector<Edge>> graph;
+    std::vector<std::pair<int, int>> edge_pos;
+};
+
+struct FlowStats
+{
+    long long augmentations = 0;
+    int demand_nodes = 0; // summed over tiers
+};
+
+// Optimal counterpart of run_batch_greedy_allotment: tiers are still served
+// in priority order, each with the capacity the earlier tiers left, but
+// within a tier the assignment places as many students as possible at the
+// minimum total travel time. Students of a tier snapped to the same node
+// form one demand node, so the network has (distinct nodes + centres) vertices.
+FlowStats run_min_cost_flow_allotment()
+{
+    std::cout << "\n🎯 Running MIN-COST FLOW Allotment..." << std::endl;
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    FlowStats stats;
+    final_assignments.clear();
+    std::vector<int> remaining(centres.size());
+    for (size_t c = 0; c < centres.size(); c++)
+    {
+        centres[c].current_load = 0;
+        remaining[c] = std::max(0, centres[c].max_capacity);
+    }
+
+    auto tiers = students_by_tier();
+    const char *tier_names[] = {"Male", "PwD", "Female"};
+    int M = (int)centres.size();
+
+    for (int tier = 0; tier < 3; tier++)
+    {
+        // Aggregate the tier's students by matrix row
+        std::unordered_map<int, int> demand_of_row;
+        std::vector<int> demand_row;
+        std::vector<std::vector<int>> demand_students;
+        for (int s : tiers[tier])
+        {
+            int r = allotment_matrix.row_of(students[s].row_key);
+            if (r == -1)
+                continue;
+            auto [it, inserted] = demand_of_row.try_emplace(r, (int)demand_row.size());
+            if (inserted)
+            {
+                demand_row.push_back(r);
+                demand_students.emplace_back();
+            }
+            demand_students[it->second].push_back(s);
+        }
+
+        int D = (int)demand_row.size();
+        int source = 0, sink = D + M + 1;
+        MinCostFlow flow(D + M + 2);
+        std::vector<std::vector<std::pair<int, int>>> demand_edges(D); // (edge id, centre)
+        for (int d = 0; d < D; d++)
         {
-            if (is_valid_assignment(student, centre))
+            int count = (int)demand_students[d].size();
+            flow.add_edge(source, 1 + d, count, 0.0);
+            const float *row = allotment_matrix.row(demand_row[d]);
+            for (int c = 0; c < M; c++)
             {
-                auto it = centre_distances.find(centre.centre_id);
-                if (it != centre_distances.end() && it->second != std::numeric_limits<double>::max())
-                {
-                    pq_pwd.push({it->second, student.student_id, centre.centre_id});
-                }
+                if (!std::isfinite(row[c]) || !is_valid_assignment(students[demand_students[d][0]], centres[c]))
+                    continue;
+                demand_edges[d].push_back({flow.add_edge(1 + d, 1 + D + c, count, row[c]), c});
             }
         }
-    }
-    size_t prev_count = assigned_students.size();
-    process_priority_queue(pq_pwd, assigned_students, centre_loads);
-    std::cout << "✅ Assigned " << (assigned_students.size() - prev_count) << " PwD students" << std::endl;
+        for (int c = 0; c < M; c++)
+        {
+            if (remaining[c] > 0)
+                flow.add_edge(1 + D + c, sink, remaining[c], 0.0);
+        }
 
-    // --- TIER 3: FEMALE ---
-    std::cout << "\n🟣 BATCH 3: Processing " << female_students.size() << " Female students..." << std::endl;
-    std::priority_queue<AssignmentPair, std::vector<AssignmentPair>, std::greater<AssignmentPair>> pq_female;
-    for (const auto &student : female_students)
-    {
-        if (allotment_lookup_map.find(student.snapped_node_id) == allotment_lookup_map.end())
-            continue;
-        const auto &centre_distances = allotment_lookup_map[student.snapped_node_id];
-        for (const auto &centre : centres)
+        auto [placed, cost] = flow.solve(source, sink);
+
+        // Hand each demand node's flow out to its students in input order
+        for (int d = 0; d < D; d++)
         {
-            if (is_valid_assignment(student, centre))
+            size_t next = 0;
+            for (auto [edge, c] : demand_edges[d])
             {
-                auto it = centre_distances.find(centre.centre_id);
-                if (it != centre_distances.end() && it->second != std::numeric_limits<double>::max())
+                for (int f = flow.flow_on(edge); f > 0; f--)
                 {
-                    pq_female.push({it->second, student.student_id, centre.centre_id});
+                    final_assignments[students[demand_students[d][next++]].student_id] = centres[c].centre_id;
+                    remaining[c]--;
+                    centres[c].current_load++;
                 }
             }
         }
+
+        stats.augmentations += flow.augmentations;
+        stats.demand_nodes += D;
+        std::cout << "✅ " << tier_names[tier] << ": " << placed << " / " << tiers[tier].size()
+                  << " assigned (" << D << " demand nodes, cost " << (long long)cost << "s)" << std::endl;
     }
-    prev_count = assigned_students.size();
-    process_priority_queue(pq_female, assigned_students, centre_loads);
-    std::cout << "✅ Assigned " << (assigned_students.size() - prev_count) << " female students" << std::endl;
 
     auto end = std::chrono::high_resolution_clock::now();
     long long total_ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
 
-    std::cout << "\n🎉 TIERED ALLOTMENT COMPLETE! Total Assigned: " << assigned_students.size()
+    std::cout << "\n🎉 MIN-COST FLOW ALLOTMENT COMPLETE! Total Assigned: " << final_assignments.size()
               << " / " << students.size() << " students in " << total_ms << "ms" << std::endl;
+
+    return stats;
 }
 
 // ==================== OLD SINGLE-PASS ALLOTMENT (DEPRECATED) ====================
 
 // Helper function for deprecated run_allotment_single_pass
-void run_local_swap_postprocess(std::unordered_map<std::string, std::vector<std::pair<std::string, long>>> &centre_to_students,
-                                const std::unordered_map<std::string, std::unordered_map<long, double>> &centre_distances_map)
+void run_local_swap_postprocess(std::unordered_map<std::string, std::vector<std::pair<std::string, long>>> &centre_to_students)
 {
     // try simple swaps: for each pair of centres, try swapping a few students
     for (size_t i = 0; i < centres.size(); ++i)
@@ -1350,8 +6004,8 @@ void run_local_swap_postprocess(std::unordered_map<std::string, std::vector<std:
                 {
                     long n1 = list1[a].second;
                     long n2 = list2[b].second;
-                    double before = centre_distances_map.at(c1).at(n1) + centre_distances_map.at(c2).at(n2);
-                    double after = centre_distances_map.at(c1).at(n2) + centre_distances_map.at(c2).at(n1);
+                    double before = allotment_matrix.distance(n1, i) + allotment_matrix.distance(n2, j);
+                    double after = allotment_matrix.distance(n2, i) + allotment_matrix.distance(n1, j);
                     if (after + 1e-9 < before)
                     {
                         // accept swap if it reduces total cost
@@ -1373,10 +6027,10 @@ void run_allotment_single_pass()
 
     auto start = std::chrono::high_resolution_clock::now();
 
-    std::unordered_map<std::string, int> centre_remaining_capacity;
-    for (const auto &centre : centres)
+    std::vector<int> centre_remaining_capacity(centres.size());
+    for (size_t c = 0; c < centres.size(); c++)
     {
-        centre_remaining_capacity[centre.centre_id] = centre.max_capacity;
+        centre_remaining_capacity[c] = centres[c].max_capacity;
     }
 
     std::vector<Student> female_students, pwd_students, male_students;
@@ -1403,24 +6057,7 @@ void run_allotment_single_pass()
 
     int total_assigned = 0;
 
-    // We still expect a centre_distances_map prepared by caller (or use allotment_lookup_map)
-    // Build a centre_distances_map from allotment_lookup_map for quick local use
-    std::unordered_map<std::string, std::unordered_map<long, double>> centre_distances_map;
-    for (const auto &centre : centres)
-    {
-        for (const auto &p : nodes)
-        {
-            long node_id = p.first;
-            double d = std::numeric_limits<double>::max();
-            if (allotment_lookup_map.find(node_id) != allotment_lookup_map.end())
-            {
-                auto &m = allotment_lookup_map[node_id];
-                if (m.find(centre.centre_id) != m.end())
-                    d = m.at(centre.centre_id);
-            }
-            centre_distances_map[centre.centre_id][node_id] = d;
-        }
-    }
+    // Distances come from allotment_matrix, prepared by the caller
 
     final_assignments.clear();
 
@@ -1433,31 +6070,26 @@ void run_allotment_single_pass()
         int tier_assigned = 0;
         for (const auto &student : tier_students)
         {
-            if (allotment_lookup_map.find(student.snapped_node_id) == allotment_lookup_map.end())
+            int r = allotment_matrix.row_of(student.row_key);
+            if (r == -1)
             {
                 continue;
             }
+            const float *centre_distances = allotment_matrix.row(r);
 
             // selection with deterministic tie-break and capacity bias
             double best_distance = std::numeric_limits<double>::max();
-            std::string best_centre_id;
+            int best_centre = -1;
             double best_secondary_metric = std::numeric_limits<double>::max(); // euclid
 
-            for (const auto &centre : centres)
+            for (size_t c = 0; c < centres.size(); c++)
             {
-                if (centre_remaining_capacity[centre.centre_id] <= 0)
+                const auto &centre = centres[c];
+                if (centre_remaining_capacity[c] <= 0)
                     continue;
-                // lookup
-                double distance = std::numeric_limits<double>::max();
-                auto itnode = centre_distances_map.find(centre.centre_id);
-                if (itnode != centre_distances_map.end())
-                {
-                    auto &cd = itnode->second;
-                    if (cd.find(student.snapped_node_id) != cd.end())
-                        distance = cd.at(student.snapped_node_id);
-                }
-                if (distance == std::numeric_limits<double>::max())
+                if (!std::isfinite(centre_distances[c]))
                     continue;
+                double distance = centre_distances[c];
 
                 // secondary metric: Euclidean (meters) to center to break near ties
                 double eu = haversine(student.lat, student.lon, centre.lat, centre.lon);
@@ -1474,13 +6106,13 @@ void run_allotment_single_pass()
                         take = true;
                     else if (std::abs(eu - best_secondary_metric) <= 1e-6)
                     {
-                        if (best_centre_id.empty() || centre.centre_id < best_centre_id)
+                        if (best_centre == -1 || centre.centre_id < centres[best_centre].centre_id)
                             take = true;
                     }
                 }
-                if (!take && std::abs(distance - best_distance) <= NEAR_TIE_M && !best_centre_id.empty())
+                if (!take && std::abs(distance - best_distance) <= NEAR_TIE_M && best_centre != -1)
                 {
-                    if (centre_remaining_capacity[centre.centre_id] > centre_remaining_capacity[best_centre_id])
+                    if (centre_remaining_capacity[c] > centre_remaining_capacity[best_centre])
                     {
                         take = true;
                     }
@@ -1489,16 +6121,16 @@ void run_allotment_single_pass()
                 if (take)
                 {
                     best_distance = distance;
-                    best_centre_id = centre.centre_id;
+                    best_centre = (int)c;
                     best_secondary_metric = eu;
                 }
             }
 
             // Only assign if we found a reachable centre (best_distance < infinity)
-            if (!best_centre_id.empty() && best_distance != std::numeric_limits<double>::max())
+            if (best_centre != -1 && best_distance != std::numeric_limits<double>::max())
             {
-                final_assignments[student.student_id] = best_centre_id;
-                centre_remaining_capacity[best_centre_id]--;
+                final_assignments[student.student_id] = centres[best_centre].centre_id;
+                centre_remaining_capacity[best_centre]--;
                 tier_assigned++;
             }
         }
@@ -1522,11 +6154,11 @@ void run_allotment_single_pass()
         if (it == final_assignments.end())
             continue;
         std::string cid = it->second;
-        centre_to_students[cid].push_back({s.student_id, s.snapped_node_id});
+        centre_to_students[cid].push_back({s.student_id, s.row_key});
     }
 
     // run local-swap postprocess (cheap)
-    run_local_swap_postprocess(centre_to_students, centre_distances_map);
+    run_local_swap_postprocess(centre_to_students);
 
     auto end = std::chrono::high_resolution_clock::now();
     long long total_ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
@@ -1536,9 +6168,259 @@ void run_allotment_single_pass()
     std::cout << "   Time: " << total_ms << "ms" << std::endl;
 }
 
+// ==================== BENCHMARKS ====================
+
+// Search throughput measurements served by /benchmark. They run against the
+// current graph and leave all global state untouched.
+
+struct BenchmarkRun
+{
+    std::string variant;
+    int queries = 0;
+    long long settled_nodes = 0;
+    double time_ms = 0.0;
+    size_t peak_queue = 0; // largest priority queue seen in any query
+    // Integer-weight variants: largest observed difference from the exact
+    // distances and the largest guaranteed bound, both in seconds
+    double max_error_seconds = -1.0;
+    double error_bound_seconds = -1.0;
+
+    double settled_per_second() const { return time_ms > 0 ? settled_nodes * 1000.0 / time_ms : 0.0; }
+};
+
+// One-to-all Dijkstra over g with the indexed heap used by the pathfinding
+// code; returns the number of settled vertices
+long long bench_dijkstra(const RoadGraph &g, int source, SearchWorkspace &ws, size_t &peak_queue)
+{
+    auto &queue = ws.queue;
+    ws.reset(g.num_nodes());
+    ws.set(source, 0.0, source);
+    queue.push(source, 0.0);
+    long long settled = 0;
+
+    while (!queue.empty())
+    {
+        peak_queue = std::max(peak_queue, queue.size());
+        int u = queue.pop();
+        double d = ws.distance(u);
+        settled++;
+        for (int e = g.offsets[u]; e < g.offsets[u + 1]; e++)
+        {
+            int v = g.targets[e];
+            double nd = d + g.weights[e];
+            if (nd < ws.distance(v))
+            {
+                ws.set(v, nd, u);
+                queue.push(v, nd);
+            }
+        }
+    }
+    return settled;
+}
+
+// The same search with the lazy-deletion binary heap dijkstra() used before
+// the indexed heap: a std::priority_queue that takes a new entry per
+// improvement and skips stale ones when popped
+long long bench_dijkstra_lazy(const RoadGraph &g, int source, std::vector<double> &dist, size_t &peak_queue)
+{
+    dist.assign(g.num_nodes(), std::numeric_limits<double>::max());
+    std::priority_queue<std::pair<double, int>,
+                        std::vector<std::pair<double, int>>,
+                        std::greater<std::pair<double, int>>>
+        pq;
+    dist[source] = 0.0;
+    pq.push({0.0, source});
+    long long settled = 0;
+
+    while (!pq.empty())
+    {
+        peak_queue = std::max(peak_queue, pq.size());
+        auto [d, u] = pq.top();
+        pq.pop();
+        if (d > dist[u])
+            continue;
+        settled++;
+        for (int e = g.offsets[u]; e < g.offsets[u + 1]; e++)
+        {
+            int v = g.targets[e];
+            double nd = d + g.weights[e];
+            if (nd < dist[v])
+            {
+                dist[v] = nd;
+                pq.push({nd, v});
+            }
+        }
+    }
+    return settled;
+}
+
+// Random connected vertices, as OSM ids so every layout runs the same queries
+std::vector<long> benchmark_sources(int queries, unsigned seed)
+{
+    std::vector<long> candidates;
+    for (int u = 0; u < road_graph.num_nodes(); u++)
+        if (road_graph.degree(u) > 0)
+            candidates.push_back(road_graph.osm_ids[u]);
+    std::sort(candidates.begin(), candidates.end());
+
+    std::vector<long> sources;
+    std::mt19937 rng(seed);
+    for (int i = 0; i < queries && !candidates.empty(); i++)
+        sources.push_back(candidates[rng() % candidates.size()]);
+    return sources;
+}
+
+// Settled nodes per second of one-to-all Dijkstra with the vertices in OSM
+// id order versus Hilbert order
+std::vector<BenchmarkRun> benchmark_node_order(int queries, unsigned seed)
+{
+    std::vector<long> sources = benchmark_sources(queries, seed);
+    std::vector<std::pair<std::string, RoadGraph>> layouts;
+    layouts.push_back({"osm_id", permuted_road_graph(road_graph, osm_id_order(road_graph))});
+    layouts.push_back({"hilbert", permuted_road_graph(road_graph, hilbert_order(road_graph))});
+
+    std::vector<BenchmarkRun> runs;
+    SearchWorkspace &ws = thread_workspace();
+    for (const auto &[name, g] : layouts)
+    {
+        BenchmarkRun run;
+        run.variant = name;
+        if (!sources.empty())
+            bench_dijkstra(g, g.index(sources[0]), ws, run.peak_queue); // warm-up
+
+        auto start = std::chrono::high_resolution_clock::now();
+        for (long source : sources)
+            run.settled_nodes += bench_dijkstra(g, g.index(source), ws, run.peak_queue);
+        auto end = std::chrono::high_resolution_clock::now();
+
+        run.queries = (int)sources.size();
+        run.time_ms = std::chrono::duration<double, std::milli>(end - start).count();
+        runs.push_back(run);
+    }
+    return runs;
+}
+
+// Settled nodes per second of one-to-all Dijkstra with the lazy binary heap
+// versus the indexed 4-ary heap, same sources, current vertex order
+std::vector<BenchmarkRun> benchmark_heaps(int queries, unsigned seed)
+{
+    std::vector<long> sources = benchmark_sources(queries, seed);
+    const RoadGraph &g = road_graph;
+    SearchWorkspace &ws = thread_workspace();
+    std::vector<double> dist;
+
+    std::vector<BenchmarkRun> runs(2);
+    runs[0].variant = "lazy_binary";
+    runs[1].variant = "indexed_4ary";
+    for (int variant = 0; variant < 2; variant++)
+    {
+        BenchmarkRun &run = runs[variant];
+        auto search = [&](long source)
+        {
+            return variant == 0 ? bench_dijkstra_lazy(g, g.index(source), dist, run.peak_queue)
+                                : bench_dijkstra(g, g.index(source), ws, run.peak_queue);
+        };
+        if (!sources.empty())
+            search(sources[0]); // warm-up
+
+        auto start = std::chrono::high_resolution_clock::now();
+        for (long source : sources)
+            run.settled_nodes += search(source);
+        auto end = std::chrono::high_resolution_clock::now();
+
+        run.queries = (int)sources.size();
+        run.time_ms = std::chrono::duration<double, std::milli>(end - start).count();
+    }
+    return runs;
+}
+
+// Settled nodes per second of the production one-to-all searches: indexed
+// heap on double weights versus radix heap on 0.1 s ticks. The ticks run also
+// reports its observed and guaranteed quantization error over all sources.
+std::vector<BenchmarkRun> benchmark_integer_weights(int queries, unsigned seed)
+{
+    std::vector<long> sources = benchmark_sources(queries, seed);
+    SearchWorkspace &exact = thread_workspace(0);
+    SearchWorkspace &ticks = thread_workspace(1);
+
+    std::vector<BenchmarkRun> runs(2);
+    runs[0].variant = "indexed_heap";
+    runs[1].variant = "radix_ticks";
+    for (int variant = 0; variant < 2; variant++)
+    {
+        BenchmarkRun &run = runs[variant];
+        auto search = [&](long source)
+        {
+            if (variant == 0)
+                dijkstra(source, exact);
+            else
+                dijkstra_ticks(source, ticks);
+            return (long long)(variant == 0 ? exact : ticks).reached_nodes().size();
+        };
+        if (!sources.empty())
+            search(sources[0]); // warm-up
+
+        auto start = std::chrono::high_resolution_clock::now();
+        for (long source : sources)
+            run.settled_nodes += search(source);
+        auto end = std::chrono::high_resolution_clock::now();
+
+        run.queries = (int)sources.size();
+        run.time_ms = std::chrono::duration<double, std::milli>(end - start).count();
+    }
+
+    BenchmarkRun &quantized = runs[1];
+    quantized.max_error_seconds = 0.0;
+    quantized.error_bound_seconds = 0.0;
+    for (long source : sources)
+    {
+        dijkstra(source, exact);
+        dijkstra_ticks(source, ticks);
+        for (int u : exact.reached_nodes())
+        {
+            quantized.max_error_seconds = std::max(quantized.max_error_seconds, exact.distance(u) - ticks.distance(u));
+            quantized.error_bound_seconds = std::max(quantized.error_bound_seconds, ticks_error_bound(ticks, u));
+        }
+    }
+    return runs;
+}
+
 // ==================== HTTP SERVER ====================
 
-int main()
+// --- FIX: SAFE ACCESS FOR CENTRES ARRAY & NESTED KEYS ---
+void parse_centres(const json &body)
+{
+    centres.clear();
+    if (body.contains("centres") && body["centres"].is_array())
+    {
+        for (const auto &c : body["centres"])
+        {
+            // Check that 'c' is actually an object before accessing
+            if (c.is_object())
+            {
+                Centre centre;
+
+                // Use .value() for safe nested access
+                centre.centre_id = c.value("centre_id", "default_id");
+                centre.lat = c.value("lat", 0.0);
+                centre.lon = c.value("lon", 0.0);
+                centre.max_capacity = c.value("max_capacity", 500);
+                centre.current_load = 0;
+                centre.has_wheelchair_access = c.value("has_wheelchair_access", false);
+                centre.is_female_only = c.value("is_female_only", false);
+
+                centres.push_back(centre);
+            }
+        }
+    }
+    else
+    {
+        std::cout << "⚠️  WARNING: No 'centres' array found in request body." << std::endl;
+    }
+}
+
+// Usage: ./server [graph.snapshot] -- an optional snapshot is loaded before serving
+int main(int argc, char **argv)
 {
     httplib::Server server;
 
@@ -1559,6 +6441,14 @@ int main()
         try {
             auto body = json::parse(req.body);
             
+            // Optional: "save_snapshot": file name, in the snapshot directory,
+            // for a later /load-graph or restart. Checked before any work.
+            std::string snapshot_name = body.value("save_snapshot", "");
+            std::string snapshot_path;
+            if (!snapshot_name.empty() && !snapshot_file_path(snapshot_name, snapshot_path)) {
+                throw std::runtime_error("save_snapshot must be a plain file name");
+            }
+            
             // --- FIX: SAFE ACCESS FOR BOUNDS ---
             // Use .value("key", default_value) to safely get data or a default
             double min_lat = body.value("min_lat", 26.0);
@@ -1570,90 +6460,231 @@ int main()
             std::string graph_detail = body.value("graph_detail", "medium");
             std::cout << "📊 Graph detail level: " << graph_detail << std::endl;
             
-            // --- FIX: SAFE ACCESS FOR CENTRES ARRAY & NESTED KEYS ---
-            centres.clear();
-            if (body.contains("centres") && body["centres"].is_array()) 
-            {
-                for (const auto& c : body["centres"]) {
-                    // Check that 'c' is actually an object before accessing
-                    if (c.is_object()) {
-                        Centre centre;
-                        
-                        // Use .value() for safe nested access
-                        centre.centre_id = c.value("centre_id", "default_id");
-                        centre.lat = c.value("lat", 0.0);
-                        centre.lon = c.value("lon", 0.0);
-                        centre.max_capacity = c.value("max_capacity", 500);
-                        centre.current_load = 0;
-                        centre.has_wheelchair_access = c.value("has_wheelchair_access", false);
-                        centre.is_female_only = c.value("is_female_only", false);
-                        
-                        centres.push_back(centre);
-                    }
-                }
-            } else {
-                std::cout << "⚠️  WARNING: No 'centres' array found in request body." << std::endl;
-            }
+            parse_centres(body);
+            
+            // Optional: "osm_file": path to a local .osm / .osm.pbf extract,
+            // loaded instead of querying Overpass (the bbox is then ignored)
+            std::string osm_file = body.value("osm_file", "");
+            std::string graph_source = osm_file.empty() ? "overpass" : "osm_file";
+            // Optional response cache settings (see OverpassCacheConfig)
+            OverpassCacheConfig overpass_cache;
+            overpass_cache.enabled = body.value("overpass_cache", true);
+            overpass_cache.offline = body.value("overpass_offline", false);
+            overpass_cache.dir = overpass_server_cache_dir;
+            int64_t cache_max_mb = body.value("overpass_cache_max_mb", (int64_t)(overpass_cache.max_bytes >> 20));
+            overpass_cache.max_bytes = (uintmax_t)std::clamp<int64_t>(cache_max_mb, 0, int64_t(1) << 40) << 20;
+            // Optional tiling: boxes wider than "tile_size_deg" (0 = one query)
+            // are fetched as tiles, "max_parallel_fetches" at a time
+            double tile_deg = body.value("tile_size_deg", OVERPASS_TILE_DEG);
+            int max_parallel = body.value("max_parallel_fetches", OVERPASS_MAX_PARALLEL);
             
+            // Responses are parsed and stitched while they download, so
+            // fetch_overpass_ms includes parsing and edge creation and
+            // build_graph_ms covers only the CSR freeze
             auto time_fetch_start = std::chrono::high_resolution_clock::now();
-            std::string osm_json_string = fetch_overpass_data(min_lat, min_lon, max_lat, max_lon, graph_detail);
+            OverpassFetchStats fetch_stats;
+            bool fetched = osm_file.empty() &&
+                           fetch_overpass_graph(min_lat, min_lon, max_lat, max_lon, graph_detail, overpass_server_url,
+                                                overpass_cache, tile_deg, max_parallel, fetch_stats);
             auto time_fetch_end = std::chrono::high_resolution_clock::now();
             
-            json osm_data = json::parse(osm_json_string);
-            
             auto time_build_graph_start = std::chrono::high_resolution_clock::now();
-            build_graph_from_overpass(osm_data);
+            if (osm_file.empty()) {
+                if (fetched) build_graph_from_overpass(fetch_stats);
+            } else {
+                std::string error;
+                if (!build_graph_from_osm_file(osm_file, graph_detail, error) || road_graph.num_nodes() == 0) {
+                    if (error.empty()) error = "no roads of detail level '" + graph_detail + "' in " + osm_file;
+                    json error_response;
+                    error_response["status"] = "error";
+                    error_response["message"] = "Failed to read OSM file: " + error;
+                    res.set_content(error_response.dump(), "application/json");
+                    return;
+                }
+            }
             auto time_build_graph_end = std::chrono::high_resolution_clock::now();
             
-            if (nodes.empty()) {
+            if (road_graph.num_nodes() == 0 && osm_file.empty()) {
                 std::cout << "\n⚠️  Overpass API failed - using simulated graph fallback" << std::endl;
                 generate_simulated_graph_fallback(min_lat, min_lon, max_lat, max_lon);
+                graph_source = "simulated";
             }
             
-            auto time_kdtree_start = std::chrono::high_resolution_clock::now();
-            std::cout << "\n🌳 Building KD-Tree for " << nodes.size() << " nodes..." << std::endl;
+            // Optional: "simplify_graph" (default true) collapses shape-only
+            // vertices into edges that keep their geometry
+            auto time_contract_start = std::chrono::high_resolution_clock::now();
+            int shape_nodes_removed = body.value("simplify_graph", true) ? contract_degree2_chains() : 0;
+            auto time_contract_end = std::chrono::high_resolution_clock::now();
             
-            std::vector<std::pair<long, std::pair<double, double>>> node_points;
-            for (const auto &[node_id, node] : nodes) {
-                if (graph.find(node_id) != graph.end() && !graph[node_id].empty()) {
-                    node_points.push_back({node_id, {node.lat, node.lon}});
-                }
+            // Optional: "node_order": "hilbert" (default) renumbers vertices
+            // for locality; "osm_id" keeps them in OSM id order
+            std::string node_order = body.value("node_order", "hilbert");
+            auto time_reorder_start = std::chrono::high_resolution_clock::now();
+            if (node_order == "hilbert") {
+                reorder_road_graph();
             }
+            auto time_reorder_end = std::chrono::high_resolution_clock::now();
             
-            std::cout << "  ✅ Filtered to " << node_points.size() << " connected nodes" << std::endl;
+            auto time_kdtree_start = std::chrono::high_resolution_clock::now();
+            std::cout << "\n🌳 Building KD-Tree for " << road_graph.num_nodes() << " nodes..." << std::endl;
             
-            if (kdtree_root) {
-                kdtree_root = nullptr;
-            }
+            // Connected vertices plus the shape points of contracted edges;
+            // the rebuild reuses the previous tree's storage
+            std::vector<KDPoint> node_points = road_snap_points();
             
-            kdtree_root = build_kdtree(node_points, 0);
+            std::cout << "  ✅ Indexed " << node_points.size() << " road points" << std::endl;
+            
+            kdtree.build(node_points, worker_count(node_points.size()));
+            tag_kdtree_components();
             auto time_kdtree_end = std::chrono::high_resolution_clock::now();
             std::cout << "✅ KD-Tree built successfully" << std::endl;
             
+            // Road segments for "snap_mode": "segment"
+            auto time_rtree_start = std::chrono::high_resolution_clock::now();
+            segment_index.build(road_segments());
+            auto time_rtree_end = std::chrono::high_resolution_clock::now();
+            std::cout << "✅ Segment R-tree built: " << segment_index.size() << " segments" << std::endl;
+            
             for (auto& centre : centres) {
                 centre.snapped_node_id = find_nearest_node(centre.lat, centre.lon);
             }
             
+            auto time_ch_start = std::chrono::high_resolution_clock::now();
+            build_contraction_hierarchy();
+            auto time_ch_end = std::chrono::high_resolution_clock::now();
+            
             auto time_dijkstra_start = std::chrono::high_resolution_clock::now();
             build_allotment_lookup();
             auto time_dijkstra_end = std::chrono::high_resolution_clock::now();
             
+            auto time_snapshot_start = std::chrono::high_resolution_clock::now();
+            bool snapshot_saved = false;
+            if (!snapshot_path.empty()) {
+                std::error_code ec;
+                std::filesystem::create_directories(snapshot_server_dir, ec);
+                snapshot_saved = save_graph_snapshot(snapshot_path);
+            }
+            auto time_snapshot_end = std::chrono::high_resolution_clock::now();
+            
             long long time_fetch_ms = std::chrono::duration_cast<std::chrono::milliseconds>(time_fetch_end - time_fetch_start).count();
             long long time_build_graph_ms = std::chrono::duration_cast<std::chrono::milliseconds>(time_build_graph_end - time_build_graph_start).count();
             long long time_kdtree_ms = std::chrono::duration_cast<std::chrono::milliseconds>(time_kdtree_end - time_kdtree_start).count();
+            long long time_rtree_ms = std::chrono::duration_cast<std::chrono::milliseconds>(time_rtree_end - time_rtree_start).count();
             long long time_dijkstra_ms = std::chrono::duration_cast<std::chrono::milliseconds>(time_dijkstra_end - time_dijkstra_start).count();
+            long long time_ch_ms = std::chrono::duration_cast<std::chrono::milliseconds>(time_ch_end - time_ch_start).count();
+            long long time_snapshot_ms = std::chrono::duration_cast<std::chrono::milliseconds>(time_snapshot_end - time_snapshot_start).count();
+            long long time_contract_ms = std::chrono::duration_cast<std::chrono::milliseconds>(time_contract_end - time_contract_start).count();
+            long long time_reorder_ms = std::chrono::duration_cast<std::chrono::milliseconds>(time_reorder_end - time_reorder_start).count();
             
             json response;
             response["status"] = "success";
-            response["nodes_count"] = nodes.size();
-            response["edges_count"] = graph.size();
+            response["nodes_count"] = road_graph.num_nodes();
+            response["edges_count"] = road_graph.num_edges();
+            response["ch_shortcuts"] = contraction_hierarchy.num_shortcuts;
+            response["shape_nodes_removed"] = shape_nodes_removed;
+            response["node_order"] = node_order == "hilbert" ? "hilbert" : "osm_id";
+            response["source"] = graph_source;
+            if (osm_file.empty()) {
+                response["overpass_tiles"] = fetch_stats.tiles;
+                response["overpass_cache_hits"] = fetch_stats.cache_hits;
+                response["overpass_retries"] = fetch_stats.retries;
+            }
+            if (!snapshot_path.empty()) {
+                response["snapshot_saved"] = snapshot_saved;
+                response["snapshot_path"] = snapshot_path;
+            }
             
             response["timing"] = {
                 {"fetch_overpass_ms", time_fetch_ms},
                 {"build_graph_ms", time_build_graph_ms},
+                {"contract_chains_ms", time_contract_ms},
+                {"reorder_nodes_ms", time_reorder_ms},
                 {"build_kdtree_ms", time_kdtree_ms},
+                {"build_rtree_ms", time_rtree_ms},
+                {"ch_preprocess_ms", time_ch_ms},
+                {"dijkstra_precompute_ms", time_dijkstra_ms},
+                {"save_snapshot_ms", time_snapshot_ms},
+                {"total_ms", time_fetch_ms + time_build_graph_ms + time_contract_ms + time_reorder_ms + time_kdtree_ms + time_rtree_ms + time_ch_ms + time_dijkstra_ms + time_snapshot_ms}
+            };
+            
+            res.set_content(response.dump(), "application/json");
+            
+        } catch (const std::exception& e) {
+            json error_response;
+            error_response["status"] = "error";
+            error_response["message"] = e.what();
+            res.set_content(error_response.dump(), "application/json");
+        } });
+
+    // ========== /load-graph endpoint ==========
+    // Body: {"path": "<snapshot>", "centres": [...]} -- replaces the graph with a
+    // snapshot written by /build-graph ("save_snapshot") and snaps the centres.
+    // "path" is a file name in the snapshot directory, like "save_snapshot".
+    // Without "centres" the current centres are re-snapped onto the new graph.
+    server.Post("/load-graph", [](const httplib::Request &req, httplib::Response &res)
+                {
+        try {
+            auto body = json::parse(req.body);
+            std::string name = body.value("path", "");
+            std::string path;
+            if (name.empty()) {
+                json error_response;
+                error_response["status"] = "error";
+                error_response["message"] = "Missing 'path' to a graph snapshot.";
+                res.set_content(error_response.dump(), "application/json");
+                return;
+            }
+            if (!snapshot_file_path(name, path)) {
+                json error_response;
+                error_response["status"] = "error";
+                error_response["message"] = "'path' must be a plain file name in the snapshot directory.";
+                res.set_content(error_response.dump(), "application/json");
+                return;
+            }
+            
+            auto time_load_start = std::chrono::high_resolution_clock::now();
+            std::string error;
+            if (!load_graph_snapshot(path, error)) {
+                json error_response;
+                error_response["status"] = "error";
+                error_response["message"] = "Failed to load snapshot: " + error;
+                res.set_content(error_response.dump(), "application/json");
+                return;
+            }
+            auto time_load_end = std::chrono::high_resolution_clock::now();
+            
+            if (body.contains("centres")) {
+                parse_centres(body);
+            }
+            for (auto& centre : centres) {
+                centre.snapped_node_id = find_nearest_node(centre.lat, centre.lon);
+            }
+            
+            // A snapshot without a hierarchy gets one now
+            auto time_ch_start = std::chrono::high_resolution_clock::now();
+            if (!contraction_hierarchy.ready()) {
+                build_contraction_hierarchy();
+            }
+            auto time_ch_end = std::chrono::high_resolution_clock::now();
+            
+            auto time_dijkstra_start = std::chrono::high_resolution_clock::now();
+            build_allotment_lookup();
+            auto time_dijkstra_end = std::chrono::high_resolution_clock::now();
+            
+            long long time_load_ms = std::chrono::duration_cast<std::chrono::milliseconds>(time_load_end - time_load_start).count();
+            long long time_ch_ms = std::chrono::duration_cast<std::chrono::milliseconds>(time_ch_end - time_ch_start).count();
+            long long time_dijkstra_ms = std::chrono::duration_cast<std::chrono::milliseconds>(time_dijkstra_end - time_dijkstra_start).count();
+            
+            json response;
+            response["status"] = "success";
+            response["nodes_count"] = road_graph.num_nodes();
+            response["edges_count"] = road_graph.num_edges();
+            response["ch_shortcuts"] = contraction_hierarchy.num_shortcuts;
+            response["timing"] = {
+                {"load_snapshot_ms", time_load_ms},
+                {"ch_preprocess_ms", time_ch_ms},
                 {"dijkstra_precompute_ms", time_dijkstra_ms},
-                {"total_ms", time_fetch_ms + time_build_graph_ms + time_kdtree_ms + time_dijkstra_ms}
+                {"total_ms", time_load_ms + time_ch_ms + time_dijkstra_ms}
             };
             
             res.set_content(response.dump(), "application/json");
@@ -1672,63 +6703,81 @@ int main()
             auto time_start = std::chrono::high_resolution_clock::now();
             auto body = json::parse(req.body);
             
-            // STEP 1: Snap students to graph nodes (using improved snapping)
+            // STEP 1: Snap students to graph nodes (using improved snapping).
+            // Optional "min_component_size": students whose nearest vertex is
+            // in a smaller component move to the nearest large enough one
+            int min_component_size = std::max(0, body.value("min_component_size", 0));
+            // Optional "snap_mode": "vertex" (default) snaps to the nearest road
+            // vertex, "segment" projects onto the nearest road segment
+            std::string snap_mode = body.value("snap_mode", "vertex");
+            if (snap_mode != "vertex" && snap_mode != "segment") {
+                throw std::runtime_error("snap_mode must be \"vertex\" or \"segment\"");
+            }
             auto time_snap_start = std::chrono::high_resolution_clock::now();
             students.clear();
+            students.reserve(body["students"].size());
             for (const auto& s : body["students"]) {
                 Student student;
                 student.student_id = s["student_id"];
                 student.lat = s["lat"];
                 student.lon = s["lon"];
                 student.category = s["category"];
-                student.snapped_node_id = find_best_snap_node_fast(student.lat, student.lon);  // Use improved snapping
-
-                // fallback: ensure snapped node in main component
-                if (student.snapped_node_id != -1) {
-                    int comp = node_component.count(student.snapped_node_id) ? node_component[student.snapped_node_id] : -1;
-                    if (comp <= 0) {
-                        long alt = find_nearest_in_main_component(student.lat, student.lon);
-                        if (alt != -1) student.snapped_node_id = alt;
-                    }
-                }
-
-                students.push_back(student);
+                student.snapped_node_id = -1;
+                students.push_back(std::move(student));
             }
+            snap_students(students, min_component_size, snap_mode == "segment");
             auto time_snap_end = std::chrono::high_resolution_clock::now();
             long long time_snap_ms = std::chrono::duration_cast<std::chrono::milliseconds>(time_snap_end - time_snap_start).count();
             
-            // STEP 2: Build Dijkstra cache from each centre
-            std::cout << "\n📍 Computing distances from centres..." << std::endl;
+            // STEP 2: Distances from every centre to the snapped student nodes.
+            // "ch" = many-to-many buckets, "dijkstra" = full search per centre,
+            // "auto" (default) = whichever the cost model expects to be cheaper
+            std::string distance_engine = body.value("distance_engine", "auto");
+            if (distance_engine != "dijkstra" && !centre_buckets.ready()) {
+                distance_engine = "dijkstra";
+            }
+            if (distance_engine == "auto") {
+                distance_engine = many_to_many_is_cheaper(students) ? "ch" : "dijkstra";
+            }
+            std::cout << "\n📍 Computing distances from centres (" << distance_engine << ")..." << std::endl;
             auto time_dijkstra_start = std::chrono::high_resolution_clock::now();
             
-            std::unordered_map<std::string, std::unordered_map<long, double>> centre_distances_map;
-            
-            for (const auto &centre : centres) {
-                std::cout << "  Dijkstra from " << centre.centre_id << "..." << std::endl;
-                centre_distances_map[centre.centre_id] = dijkstra(centre.snapped_node_id);
-            }
-
-            // Update global allotment lookup map (so diagnostics and swaps can use it)
-            allotment_lookup_map.clear();
-            for (const auto &c : centres) {
-                const auto &dmap = centre_distances_map[c.centre_id];
-                for (const auto &p : dmap) {
-                    allotment_lookup_map[p.first][c.centre_id] = p.second;
-                }
+            // Optional: "integer_weights" (dijkstra engine only) runs the centre
+            // searches on 0.1 s ticks with a radix heap
+            bool integer_weights = distance_engine == "dijkstra" && body.value("integer_weights", false);
+            double quantization_error_bound = 0.0;
+            if (distance_engine == "ch") {
+                build_student_lookup(students);
+            } else {
+                // Fills the global allotment lookup map (so diagnostics and swaps can use it)
+                quantization_error_bound = build_full_lookup(students, integer_weights);
             }
             
             auto time_dijkstra_end = std::chrono::high_resolution_clock::now();
             long long time_dijkstra_ms = std::chrono::duration_cast<std::chrono::milliseconds>(time_dijkstra_end - time_dijkstra_start).count();
             
-            // STEP 3: Run Distance-First Priority Queue Allotment
-            std::cout << "\n🎯 Running Distance-First allotment..." << std::endl;
+            // STEP 3: Run the allotment. "greedy" (default) = Distance-First
+            // priority queue, "min_cost_flow" = optimal per tier, slower
+            std::string allotment_algorithm = body.value("allotment_algorithm", "greedy");
+            if (allotment_algorithm != "min_cost_flow") {
+                allotment_algorithm = "greedy";
+            }
+            std::cout << "\n🎯 Running " << allotment_algorithm << " allotment..." << std::endl;
             auto time_allotment_start = std::chrono::high_resolution_clock::now();
             
-            // Call the new distance-first algorithm
-            run_batch_greedy_allotment();
+            // "candidate_k": keep only the K nearest centres per student (0 = all pairs)
+            int candidate_k = std::max(0, body.value("candidate_k", 0));
+            GreedyStats greedy_stats;
+            FlowStats flow_stats;
+            if (allotment_algorithm == "min_cost_flow") {
+                flow_stats = run_min_cost_flow_allotment();
+            } else {
+                greedy_stats = run_batch_greedy_allotment(candidate_k);
+            }
             
             auto time_allotment_end = std::chrono::high_resolution_clock::now();
             long long time_allotment_ms = std::chrono::duration_cast<std::chrono::milliseconds>(time_allotment_end - time_allotment_start).count();
+            double objective_seconds = assignment_objective();
             
             auto time_end = std::chrono::high_resolution_clock::now();
             long long time_total_ms = std::chrono::duration_cast<std::chrono::milliseconds>(time_end - time_start).count();
@@ -1738,22 +6787,42 @@ int main()
             std::cout << "   Snap Time: " << time_snap_ms << "ms" << std::endl;
             std::cout << "   Dijkstra Time: " << time_dijkstra_ms << "ms" << std::endl;
             std::cout << "   Allotment Time: " << time_allotment_ms << "ms" << std::endl;
+            std::cout << "   Objective: " << (long long)objective_seconds << "s total travel time" << std::endl;
             std::cout << "   Total Time: " << time_total_ms << "ms" << std::endl;
             
             json response;
             response["status"] = "success";
             response["assignments"] = final_assignments;
+            response["distance_engine"] = distance_engine;
+            response["integer_weights"] = integer_weights;
+            if (integer_weights) {
+                response["quantization_error_bound_seconds"] = quantization_error_bound;
+            }
+            response["allotment_algorithm"] = allotment_algorithm;
+            response["objective_seconds"] = objective_seconds;
+            if (allotment_algorithm == "min_cost_flow") {
+                response["flow_augmentations"] = flow_stats.augmentations;
+                response["flow_demand_nodes"] = flow_stats.demand_nodes;
+            } else {
+                response["allotment_mode"] = candidate_k > 0 ? "top_k" : "exhaustive";
+                response["candidate_k"] = candidate_k;
+                response["candidate_widenings"] = greedy_stats.widenings;
+                response["peak_candidate_entries"] = greedy_stats.peak_entries;
+            }
             
             // --- NEW DEBUGGING CODE ---
             json all_distances;
             for (const auto& student : students) {
-                if (allotment_lookup_map.find(student.snapped_node_id) != allotment_lookup_map.end()) {
+                json student_distances = json::object();
+                int r = allotment_matrix.row_of(student.row_key);
+                if (r != -1) {
                     // Add all pre-computed distances for this student
-                    all_distances[student.student_id] = allotment_lookup_map[student.snapped_node_id];
-                } else {
-                    // Student's node wasn't in the map (e.g., snapped to -1)
-                    all_distances[student.student_id] = json::object();
+                    for (size_t c = 0; c < centres.size(); c++) {
+                        student_distances[centres[c].centre_id] = allotment_matrix.distance(student.row_key, (int)c);
+                    }
                 }
+                // Otherwise the student's node has no row (e.g., snapped to -1)
+                all_distances[student.student_id] = student_distances;
             }
             response["debug_distances"] = all_distances;
             // --- END NEW DEBUGGING CODE ---
@@ -1833,10 +6902,9 @@ int main()
                 student_json["category"] = student.category;
                 student_json["snap_node_id"] = student.snapped_node_id;
                 
-                // Calculate snap distance
-                if (nodes.find(student.snapped_node_id) != nodes.end()) {
-                    const Node &snapped_node = nodes[student.snapped_node_id];
-                    double snap_dist = haversine(student.lat, student.lon, snapped_node.lat, snapped_node.lon);
+                // Snap distance, recorded when the student was snapped
+                if (student.snap_distance_m >= 0) {
+                    double snap_dist = student.snap_distance_m;
                     student_json["snap_distance_m"] = snap_dist;
                     sum_snap_distance += snap_dist;
                     snap_count++;
@@ -1855,19 +6923,16 @@ int main()
                 double best = std::numeric_limits<double>::max();
                 double second_best = std::numeric_limits<double>::max();
                 std::string best_id = "";
-                for (const auto &centre : centres) {
-                    double d = std::numeric_limits<double>::max();
-                    if (allotment_lookup_map.find(student.snapped_node_id) != allotment_lookup_map.end()) {
-                        auto &m = allotment_lookup_map[student.snapped_node_id];
-                        if (m.find(centre.centre_id) != m.end()) d = m.at(centre.centre_id);
-                    }
+                for (size_t c = 0; c < centres.size(); c++) {
+                    const auto &centre = centres[c];
+                    double d = allotment_matrix.distance(student.row_key, (int)c);
                     alt[centre.centre_id] = d;
                     if (d < std::numeric_limits<double>::max()) reachable_centres++;
                     if (d < best) { second_best = best; best = d; best_id = centre.centre_id; }
                     else if (d < second_best) second_best = d;
                 }
                 student_json["alt_distances_m"] = alt;
-                student_json["component_id"] = node_component.count(student.snapped_node_id) ? node_component[student.snapped_node_id] : -1;
+                student_json["component_id"] = student.component_id;
                 student_json["reachable_count"] = reachable_centres;
                 student_json["near_tie"] = (second_best < std::numeric_limits<double>::max() && std::abs(second_best - best) < 20.0);
 
@@ -1902,6 +6967,17 @@ int main()
             std::vector<long> student_candidates;
             std::vector<long> centre_candidates;
             
+            // Optional: "snap_mode" = "segment" starts from the student's
+            // projection onto the nearest road segment, seeding the search
+            // from both ends of that road. As in /run-allotment, the road must
+            // lie in the component the student's vertex snap chose, which
+            // "min_component_size" can steer away from small islands.
+            bool segment_snap = req.has_param("snap_mode") && req.get_param_value("snap_mode") == "segment";
+            int min_component_size = req.has_param("min_component_size")
+                ? std::max(0, std::stoi(req.get_param_value("min_component_size"))) : 0;
+            EdgeSnap student_snap;
+            std::vector<SearchSeed> student_seeds;
+            
             if (req.has_param("student_node_id") && req.has_param("centre_node_id")) {
                 student_candidates.push_back(std::stol(req.get_param_value("student_node_id")));
                 centre_candidates.push_back(std::stol(req.get_param_value("centre_node_id")));
@@ -1915,28 +6991,100 @@ int main()
                 student_candidates = find_k_nearest_nodes(student_lat, student_lon, 5);
                 centre_candidates = find_k_nearest_nodes(centre_lat, centre_lon, 5);
                 
+                Student probe;
+                probe.lat = student_lat;
+                probe.lon = student_lon;
+                if (segment_snap) {
+                    snap_student(probe, min_component_size, true);
+                    student_snap = probe.edge_snap;
+                }
+                if (student_snap.valid()) {
+                    const double INF = std::numeric_limits<double>::max();
+                    if (student_snap.seconds_to_start != INF)
+                        student_seeds.push_back({road_graph.index(student_snap.start_node), student_snap.seconds_to_start});
+                    if (student_snap.seconds_to_end != INF)
+                        student_seeds.push_back({road_graph.index(student_snap.end_node), student_snap.seconds_to_end});
+                }
+                
                 std::cout << "Finding path: trying " << student_candidates.size() 
                           << "x" << centre_candidates.size() << " combinations" << std::endl;
             } else {
                 throw std::runtime_error("Missing required parameters");
             }
             
+            // Optional: "algorithm" = "ch" (default once preprocessed),
+            // "astar" (default otherwise) or "bidirectional"
+            std::string algorithm = req.has_param("algorithm") ? req.get_param_value("algorithm")
+                                                               : (contraction_hierarchy.ready() ? "ch" : "astar");
+            if (algorithm != "ch" && algorithm != "astar" && algorithm != "bidirectional") {
+                throw std::runtime_error("Unknown algorithm: " + algorithm);
+            }
+            if (algorithm == "ch" && !contraction_hierarchy.ready()) {
+                algorithm = "astar";
+            }
+            
             auto time_astar_start = std::chrono::high_resolution_clock::now();
             std::vector<long> best_path;
             bool found = false;
+            long long settled_nodes = 0;
+            double travel_time = std::numeric_limits<double>::max();
+            
+            // From the segment snap first; if it reaches no centre candidate,
+            // fall back to the nearest student vertices below
+            if (!student_seeds.empty()) {
+                for (long centre_node : centre_candidates) {
+                    int centre_index = road_graph.index(centre_node);
+                    if (centre_index == -1) {
+                        continue;
+                    }
+                    SearchStats stats;
+                    std::vector<long> path;
+                    if (algorithm == "ch") {
+                        for (int u : ch_shortest_path(student_seeds, centre_index, stats))
+                            path.push_back(road_graph.osm_ids[u]);
+                    } else if (algorithm == "bidirectional") {
+                        path = a_star_bidirectional(student_seeds, centre_index, &stats);
+                    } else {
+                        path = a_star(student_seeds, centre_index, &stats);
+                    }
+                    settled_nodes += stats.settled;
+                    if (!path.empty()) {
+                        best_path = path;
+                        travel_time = stats.distance;
+                        found = true;
+                        std::cout << "✓ Found path: road " << student_snap.start_node << "-" << student_snap.end_node
+                                  << " -> " << centre_node << " (" << path.size() << " nodes)" << std::endl;
+                        break;
+                    }
+                }
+                if (!found) {
+                    std::cout << "Segment snap reaches no centre candidate, trying vertices" << std::endl;
+                    student_seeds.clear();
+                }
+            }
             
-            for (long student_node : student_candidates) {
+            for (size_t i = 0; !found && i < student_candidates.size(); i++) {
+                long student_node = student_candidates[i];
                 for (long centre_node : centre_candidates) {
-                    auto path = a_star(student_node, centre_node);
+                    SearchStats stats;
+                    std::vector<long> path;
+                    if (algorithm == "ch") {
+                        path = ch_query(student_node, centre_node, &stats);
+                    } else if (algorithm == "bidirectional") {
+                        path = a_star_bidirectional(student_node, centre_node, &stats);
+                    } else {
+                        path = a_star(student_node, centre_node, &stats);
+                    }
+                    settled_nodes += stats.settled;
                     if (!path.empty()) {
                         best_path = path;
+                        travel_time = stats.distance;
                         found = true;
                         std::cout << "✓ Found path: " << student_node << " -> " 
                                   << centre_node << " (" << path.size() << " nodes)" << std::endl;
                         break;
                     }
                 }
-                if (found) break;
             }
             auto time_astar_end = std::chrono::high_resolution_clock::now();
             
@@ -1947,14 +7095,27 @@ int main()
             json response;
             response["status"] = "success";
             
+            // Full road geometry, including shape points of contracted edges
             json path_coords = json::array();
-            for (long node_id : best_path) {
-                if (nodes.find(node_id) != nodes.end()) {
-                    path_coords.push_back({nodes[node_id].lat, nodes[node_id].lon});
+            if (found && !student_seeds.empty()) {
+                for (const auto &[lat, lon] : edge_snap_geometry(student_snap, best_path.front())) {
+                    path_coords.push_back({lat, lon});
                 }
             }
+            for (const auto &[lat, lon] : path_geometry(best_path)) {
+                path_coords.push_back({lat, lon});
+            }
             
             response["path"] = path_coords;
+            response["snap_mode"] = student_seeds.empty() ? "vertex" : "segment";
+            if (!student_seeds.empty()) {
+                response["snap_distance_m"] = student_snap.distance_m;
+            }
+            response["algorithm"] = algorithm;
+            response["settled_nodes"] = settled_nodes;
+            if (found) {
+                response["travel_time_seconds"] = travel_time;
+            }
             
             auto time_end = std::chrono::high_resolution_clock::now();
             long long time_astar_ms = std::chrono::duration_cast<std::chrono::milliseconds>(time_astar_end - time_astar_start).count();
@@ -1996,7 +7157,7 @@ int main()
                 return;
             }
             
-            if (nodes.empty() || graph.empty()) {
+            if (road_graph.num_nodes() == 0 || road_graph.num_edges() == 0) {
                 json error_response;
                 error_response["status"] = "error";
                 error_response["message"] = "Graph not built. Please call /build-graph first.";
@@ -2004,37 +7165,43 @@ int main()
                 return;
             }
             
-            std::cout << "   Processing " << centres.size() << " centres..." << std::endl;
+            // Save results if requested
+            bool save_to_files = body.value("save_to_files", false);
+            std::string output_dir = body.value("output_dir", "./");
             
-            // Parallel execution using std::async
-            std::vector<std::future<DijkstraResult>> futures;
+            // Optional: "integer_weights" runs the searches on weights rounded
+            // down to 0.1 s with a radix heap instead of the binary heap
+            bool integer_weights = body.value("integer_weights", false);
             
-            auto parallel_start = std::chrono::high_resolution_clock::now();
+            // Pool size: "num_threads" if given, otherwise one per hardware
+            // thread; never more than worker_count() allows, since each
+            // thread keeps its own O(V) search workspace
+            int requested_threads = body.value("num_threads", 0);
+            int num_threads = requested_threads > 0
+                ? std::min(requested_threads, worker_count(centres.size()))
+                : worker_count(centres.size());
             
-            // Launch async tasks for each centre
-            for (const auto &centre : centres) {
-                futures.push_back(std::async(std::launch::async, 
-                                            run_dijkstra_for_centre, 
-                                            std::ref(centre)));
-            }
+            std::cout << "   Processing " << centres.size() << " centres on "
+                      << num_threads << " threads..." << std::endl;
             
-            // Collect results
-            std::vector<DijkstraResult> results;
-            for (auto &future : futures) {
-                results.push_back(future.get());
-            }
+            WorkStealingPool pool(num_threads);
+            std::vector<DijkstraResult> results(centres.size());
+            
+            auto parallel_start = std::chrono::high_resolution_clock::now();
+            
+            auto worker_stats = pool.run(centres.size(), [&](size_t c, int) {
+                results[c] = run_dijkstra_for_centre(centres[c], integer_weights, save_to_files, output_dir);
+            });
             
             auto parallel_end = std::chrono::high_resolution_clock::now();
+            double parallel_wall_ms = std::chrono::duration<double, std::milli>(parallel_end - parallel_start).count();
             long long parallel_time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
                 parallel_end - parallel_start).count();
             
-            // Save results if requested
-            bool save_to_files = body.value("save_to_files", false);
-            std::string output_dir = body.value("output_dir", "./");
-            
             int successful_count = 0;
             int failed_count = 0;
             long long total_computation_time = 0;
+            double error_bound_seconds = 0.0;
             
             json results_json = json::array();
             
@@ -2049,24 +7216,17 @@ int main()
                     successful_count++;
                     total_computation_time += result.computation_time_ms;
                     
-                    result_obj["reachable_nodes"] = 0;
-                    for (const auto &[node, dist] : result.distances) {
-                        if (dist != std::numeric_limits<double>::max()) {
-                            result_obj["reachable_nodes"] = 
-                                result_obj["reachable_nodes"].get<int>() + 1;
-                        }
+                    result_obj["reachable_nodes"] = result.reachable_nodes;
+                    if (integer_weights) {
+                        result_obj["quantization_error_bound_seconds"] = result.error_bound_seconds;
+                        error_bound_seconds = std::max(error_bound_seconds, result.error_bound_seconds);
                     }
                     
-                    // Save to files if requested
                     if (save_to_files) {
-                        std::string dist_file = output_dir + result.centre_id + "_distances.json";
-                        std::string parent_file = output_dir + result.centre_id + "_parents.json";
-                        
-                        bool saved = save_dijkstra_results(result, dist_file, parent_file);
-                        result_obj["saved_to_files"] = saved;
-                        if (saved) {
-                            result_obj["distances_file"] = dist_file;
-                            result_obj["parents_file"] = parent_file;
+                        result_obj["saved_to_files"] = result.saved_to_files;
+                        if (result.saved_to_files) {
+                            result_obj["distances_file"] = result.distances_file;
+                            result_obj["parents_file"] = result.parents_file;
                         }
                     }
                 } else {
@@ -2085,9 +7245,21 @@ int main()
             double avg_sequential_time = successful_count > 0 ? 
                 (double)total_computation_time / successful_count : 0;
             double estimated_sequential_time = avg_sequential_time * centres.size();
-            double speedup = estimated_sequential_time > 0 ? 
+            double speedup = estimated_sequential_time > 0 && parallel_time_ms > 0 ? 
                 estimated_sequential_time / parallel_time_ms : 0;
             
+            // Share of the parallel section each worker spent running searches
+            json worker_utilisation = json::array();
+            for (int w = 0; w < pool.size(); w++) {
+                worker_utilisation.push_back({
+                    {"worker", w},
+                    {"tasks", worker_stats[w].tasks},
+                    {"steals", worker_stats[w].steals},
+                    {"busy_ms", worker_stats[w].busy_ms},
+                    {"utilisation", parallel_wall_ms > 0 ? worker_stats[w].busy_ms / parallel_wall_ms : 0.0}
+                });
+            }
+            
             std::cout << "\n✅ Parallel Dijkstra Complete!" << std::endl;
             std::cout << "   Successful: " << successful_count << " / " << centres.size() << std::endl;
             std::cout << "   Failed: " << failed_count << std::endl;
@@ -2102,6 +7274,10 @@ int main()
             response["centres_processed"] = centres.size();
             response["successful"] = successful_count;
             response["failed"] = failed_count;
+            response["integer_weights"] = integer_weights;
+            if (integer_weights) {
+                response["quantization_error_bound_seconds"] = error_bound_seconds;
+            }
             response["results"] = results_json;
             
             response["timing"] = {
@@ -2113,9 +7289,11 @@ int main()
             };
             
             response["performance_metrics"] = {
-                {"num_threads_used", centres.size()},
-                {"nodes_in_graph", nodes.size()},
-                {"edges_in_graph", graph.size()}
+                {"num_threads_requested", requested_threads},
+                {"num_threads_used", pool.size()},
+                {"worker_utilisation", worker_utilisation},
+                {"nodes_in_graph", road_graph.num_nodes()},
+                {"edges_in_graph", road_graph.num_edges()}
             };
             
             res.set_content(response.dump(2), "application/json");
@@ -2128,6 +7306,93 @@ int main()
             res.set_content(error_response.dump(), "application/json");
         } });
 
+    // ========== /benchmark endpoint ==========
+    // Body: {"suite": "node_order", "queries": 50, "seed": 1} -- measures
+    // search throughput on the current graph in each variant of the suite
+    server.Post("/benchmark", [](const httplib::Request &req, httplib::Response &res)
+                {
+        try {
+            auto body = req.body.empty() ? json::object() : json::parse(req.body);
+            std::string suite = body.value("suite", "node_order");
+            int queries = body.value("queries", 50);
+            unsigned seed = body.value("seed", 1u);
+            
+            if (road_graph.num_nodes() == 0) {
+                throw std::runtime_error("Graph not built. Call /build-graph first.");
+            }
+            
+            std::vector<BenchmarkRun> runs;
+            if (suite == "node_order") {
+                runs = benchmark_node_order(queries, seed);
+            } else if (suite == "heap") {
+                runs = benchmark_heaps(queries, seed);
+            } else if (suite == "integer_weights") {
+                runs = benchmark_integer_weights(queries, seed);
+            } else {
+                throw std::runtime_error("Unknown benchmark suite: " + suite);
+            }
+            
+            json results = json::array();
+            for (const auto &run : runs) {
+                std::cout << "⏱️  " << suite << "/" << run.variant << ": " << run.settled_nodes << " settled in "
+                          << run.time_ms << " ms (" << (long long)run.settled_per_second() << " nodes/s)" << std::endl;
+                json result = {
+                    {"variant", run.variant},
+                    {"queries", run.queries},
+                    {"settled_nodes", run.settled_nodes},
+                    {"time_ms", run.time_ms},
+                    {"settled_per_second", run.settled_per_second()}
+                };
+                if (run.peak_queue > 0) {
+                    result["peak_queue"] = run.peak_queue;
+                }
+                if (run.error_bound_seconds >= 0) {
+                    result["max_error_seconds"] = run.max_error_seconds;
+                    result["error_bound_seconds"] = run.error_bound_seconds;
+                }
+                results.push_back(result);
+            }
+            
+            json response;
+            response["status"] = "success";
+            response["suite"] = suite;
+            response["nodes_in_graph"] = road_graph.num_nodes();
+            response["results"] = results;
+            if (runs.size() == 2 && runs[0].settled_per_second() > 0) {
+                response["speedup"] = runs[1].settled_per_second() / runs[0].settled_per_second();
+            }
+            res.set_content(response.dump(2), "application/json");
+            
+        } catch (const std::exception& e) {
+            json error_response;
+            error_response["status"] = "error";
+            error_response["message"] = e.what();
+            res.set_content(error_response.dump(), "application/json");
+        } });
+
+    if (const char *url = std::getenv("OVERPASS_URL"))
+    {
+        overpass_server_url = url;
+        std::cout << "🌐 Overpass endpoint: " << overpass_server_url << std::endl;
+    }
+    if (const char *dir = std::getenv("OVERPASS_CACHE_DIR"))
+    {
+        overpass_server_cache_dir = dir;
+        std::cout << "🗂️  Overpass cache: " << overpass_server_cache_dir << std::endl;
+    }
+    if (const char *dir = std::getenv("GRAPH_SNAPSHOT_DIR"))
+    {
+        snapshot_server_dir = dir;
+        std::cout << "🗂️  Graph snapshots: " << snapshot_server_dir << std::endl;
+    }
+
+    if (argc > 1)
+    {
+        std::string error;
+        if (!load_graph_snapshot(argv[1], error))
+            std::cerr << "❌ Could not load snapshot " << argv[1] << ": " << error << std::endl;
+    }
+
     std::cout << "Server starting on http://localhost:8080" << std::endl;
     server.listen("0.0.0.0", 8080);
 
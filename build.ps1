@@ -22,11 +22,11 @@ Write-Host ""
 Set-Location -Path "backend"
 
 Write-Host "Compiling backend server..." -ForegroundColor Yellow
-Write-Host "Command: g++ -std=c++17 main.cpp -o server.exe -I.. -lcurl -lws2_32" -ForegroundColor Gray
+Write-Host "Command: g++ -std=c++17 -O2 main.cpp -o server.exe -I.. -lcurl -lz -lws2_32" -ForegroundColor Gray
 Write-Host ""
 
 # Compile
-$compileResult = & g++ -std=c++17 main.cpp -o server.exe -I.. -lcurl -lws2_32 2>&1
+$compileResult = & g++ -std=c++17 -O2 main.cpp -o server.exe -I.. -lcurl -lz -lws2_32 2>&1
 
 if ($LASTEXITCODE -ne 0) {
     Write-Host "COMPILATION FAILED!" -ForegroundColor Red
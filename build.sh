@@ -23,11 +23,11 @@ echo ""
 cd backend
 
 echo "Compiling backend server..."
-echo "Command: g++ -std=c++17 main.cpp -o server -I.. -lcurl -lpthread"
+echo "Command: g++ -std=c++17 -O2 main.cpp -o server -I.. -lcurl -lz -lpthread"
 echo ""
 
 # Compile
-if g++ -std=c++17 main.cpp -o server -I.. -lcurl -lpthread; then
+if g++ -std=c++17 -O2 main.cpp -o server -I.. -lcurl -lz -lpthread; then
     echo "Compilation successful!"
     echo ""
     